@@ -0,0 +1,227 @@
+/*
+ * Semtech SX9324 - decoding and batch analysis of the phase data records
+ * streamed through /dev/sx9324-<dev>
+ *
+ * Copyright (C) 2020 FIH Mobile Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libsx9324.h"
+
+/*
+ * The four phases of a field are one vector, the compiler maps the
+ * operations onto SSE/NEON lanes. Lanes are 32 bits wide so sums and
+ * squares of 16 bits values do not overflow within a record.
+ */
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef int64_t v4di __attribute__((vector_size(32)));
+
+/* phases accumulated in 32 bits lanes before spilling to 64 bits */
+#define SX9324_LIB_BLOCK	65536
+
+static const int16_t *sx9324_field_ptr(const struct sx9324_sample *sample,
+	enum sx9324_field field)
+{
+	switch (field) {
+	case SX9324_FIELD_AVG:
+		return sample->avg;
+	case SX9324_FIELD_DIFF:
+		return sample->diff;
+	default:
+		return sample->useful;
+	}
+}
+
+static v4si sx9324_load(const struct sx9324_sample *sample,
+	enum sx9324_field field)
+{
+	const int16_t *p = sx9324_field_ptr(sample, field);
+
+	return (v4si){ p[0], p[1], p[2], p[3] };
+}
+
+/* all ones in the lanes of the valid phases */
+static v4si sx9324_valid_mask(const struct sx9324_sample *sample)
+{
+	uint8_t valid = sample->valid;
+
+	return -(v4si){ valid & 1, (valid >> 1) & 1, (valid >> 2) & 1,
+		(valid >> 3) & 1 };
+}
+
+static uint8_t sx9324_lane_bits(v4si v)
+{
+	return (v[0] ? 1 : 0) | (v[1] ? 2 : 0) | (v[2] ? 4 : 0) |
+		(v[3] ? 8 : 0);
+}
+
+long sx9324_read_samples(int fd, struct sx9324_sample *samples, size_t max)
+{
+	ssize_t len;
+
+	if (!max)
+		return -EINVAL;
+
+	do {
+		len = read(fd, samples, max * sizeof(*samples));
+	} while (len < 0 && errno == EINTR);
+	if (len < 0)
+		return -errno;
+
+	return len / sizeof(*samples);
+}
+
+long sx9324_decode_samples(const void *buf, size_t len,
+	const struct sx9324_sample **samples)
+{
+	if (len % sizeof(**samples) ||
+		(uintptr_t)buf % _Alignof(struct sx9324_sample))
+		return -EINVAL;
+
+	*samples = buf;
+	return len / sizeof(**samples);
+}
+
+size_t sx9324_moving_average(const struct sx9324_sample *samples, size_t n,
+	enum sx9324_field field, unsigned int window,
+	int16_t out[][SX9324_LIB_PHASES])
+{
+	v4si sum = { 0 };
+	v4si avg;
+	size_t i;
+	int j;
+
+	if (!window || window > SX9324_LIB_BLOCK || n < window)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		sum += sx9324_load(&samples[i], field) &
+			sx9324_valid_mask(&samples[i]);
+		if (i >= window)
+			sum -= sx9324_load(&samples[i - window], field) &
+				sx9324_valid_mask(&samples[i - window]);
+		if (i + 1 < window)
+			continue;
+
+		/* the division truncates toward 0 */
+		avg = sum / (v4si){ window, window, window, window };
+		for (j = 0; j < SX9324_LIB_PHASES; j++)
+			out[i + 1 - window][j] = avg[j];
+	}
+
+	return n - window + 1;
+}
+
+void sx9324_field_stats(const struct sx9324_sample *samples, size_t n,
+	enum sx9324_field field, struct sx9324_field_stats *stats)
+{
+	v4si vmin = { INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX };
+	v4si vmax = { INT16_MIN, INT16_MIN, INT16_MIN, INT16_MIN };
+	v4si count, sum;
+	v4di sumsq, sq;
+	v4si v, m, sel;
+	size_t i, end;
+	int j;
+
+	for (j = 0; j < SX9324_LIB_PHASES; j++) {
+		if (stats->count[j]) {
+			vmin[j] = stats->min[j];
+			vmax[j] = stats->max[j];
+		}
+	}
+
+	for (i = 0; i < n; i = end) {
+		end = n - i > SX9324_LIB_BLOCK ? i + SX9324_LIB_BLOCK : n;
+		count = (v4si){ 0 };
+		sum = (v4si){ 0 };
+		sumsq = (v4di){ 0 };
+		for (; i < end; i++) {
+			m = sx9324_valid_mask(&samples[i]);
+			v = sx9324_load(&samples[i], field);
+			count -= m;
+			sum += v & m;
+			/* squares of 16 bits fit 32 bits lanes, not their sum */
+			sq = __builtin_convertvector((v * v) & m, v4di);
+			sumsq += sq;
+			sel = (v < vmin) & m;
+			vmin = (v & sel) | (vmin & ~sel);
+			sel = (v > vmax) & m;
+			vmax = (v & sel) | (vmax & ~sel);
+		}
+		for (j = 0; j < SX9324_LIB_PHASES; j++) {
+			stats->count[j] += count[j];
+			stats->sum[j] += sum[j];
+			stats->sumsq[j] += sumsq[j];
+		}
+	}
+
+	for (j = 0; j < SX9324_LIB_PHASES; j++) {
+		if (stats->count[j]) {
+			stats->min[j] = vmin[j];
+			stats->max[j] = vmax[j];
+		}
+	}
+}
+
+double sx9324_field_mean(const struct sx9324_field_stats *stats, int phase)
+{
+	if (!stats->count[phase])
+		return 0;
+
+	return (double)stats->sum[phase] / stats->count[phase];
+}
+
+double sx9324_field_variance(const struct sx9324_field_stats *stats,
+	int phase)
+{
+	double n = stats->count[phase];
+	double sum = stats->sum[phase];
+
+	if (stats->count[phase] < 2)
+		return 0;
+
+	return (stats->sumsq[phase] - sum * sum / n) / (n - 1);
+}
+
+size_t sx9324_crossings(const struct sx9324_sample *samples, size_t n,
+	enum sx9324_field field, const int16_t threshold[SX9324_LIB_PHASES],
+	uint8_t up[], uint8_t down[])
+{
+	v4si thr = { threshold[0], threshold[1], threshold[2], threshold[3] };
+	v4si known = { 0 };
+	v4si above = { 0 };
+	v4si now, m, vup, vdown;
+	size_t crossings = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		m = sx9324_valid_mask(&samples[i]);
+		now = sx9324_load(&samples[i], field) >= thr;
+		vup = m & known & now & ~above;
+		vdown = m & known & ~now & above;
+		/* a phase not valid keeps its last state */
+		above = (now & m) | (above & ~m);
+		known |= m;
+
+		up[i] = sx9324_lane_bits(vup);
+		down[i] = sx9324_lane_bits(vdown);
+		crossings += __builtin_popcount(up[i]) +
+			__builtin_popcount(down[i]);
+	}
+
+	return crossings;
+}
@@ -0,0 +1,87 @@
+/*
+ * Semtech SX9324 - decoding and batch analysis of the phase data records
+ * streamed through /dev/sx9324-<dev>
+ *
+ * Copyright (C) 2020 FIH Mobile Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef LIBSX9324_H
+#define LIBSX9324_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sx9324.h"
+
+#define SX9324_LIB_PHASES	4
+
+/* the per-phase arrays of struct sx9324_sample */
+enum sx9324_field {
+	SX9324_FIELD_USEFUL,
+	SX9324_FIELD_AVG,
+	SX9324_FIELD_DIFF,
+};
+
+/* statistics of a field, of the records having the phase valid */
+struct sx9324_field_stats {
+	uint64_t count[SX9324_LIB_PHASES];
+	int64_t sum[SX9324_LIB_PHASES];
+	uint64_t sumsq[SX9324_LIB_PHASES];
+	int16_t min[SX9324_LIB_PHASES];
+	int16_t max[SX9324_LIB_PHASES];
+};
+
+/*
+ * Read as many whole records as fit in samples from the chip device fd.
+ * Returns the number of records, 0 at end of stream or a negative errno.
+ */
+long sx9324_read_samples(int fd, struct sx9324_sample *samples, size_t max);
+
+/*
+ * Decode len bytes of records, e.g. of a capture file. Returns the number
+ * of whole records, pointing *samples at them, or -EINVAL if len is not a
+ * multiple of the record size or buf is not aligned for one.
+ */
+long sx9324_decode_samples(const void *buf, size_t len,
+	const struct sx9324_sample **samples);
+
+/*
+ * Moving average of a field over window records, at most 65536, out[i]
+ * for records i from window - 1 on. A phase not valid in a record counts
+ * as 0.
+ * Returns the number of averages written, n - window + 1.
+ */
+size_t sx9324_moving_average(const struct sx9324_sample *samples, size_t n,
+	enum sx9324_field field, unsigned int window,
+	int16_t out[][SX9324_LIB_PHASES]);
+
+/* accumulate the statistics of a field, stats zeroed for a new batch */
+void sx9324_field_stats(const struct sx9324_sample *samples, size_t n,
+	enum sx9324_field field, struct sx9324_field_stats *stats);
+
+double sx9324_field_mean(const struct sx9324_field_stats *stats, int phase);
+
+/* sample variance, 0 below two records */
+double sx9324_field_variance(const struct sx9324_field_stats *stats,
+	int phase);
+
+/*
+ * Threshold crossings of a field, phase n being bit n. up[i] has the
+ * phases reaching threshold at record i from below at record i - 1, down[i]
+ * those dropping below it. Records with the phase not valid are skipped.
+ * Returns the number of crossings.
+ */
+size_t sx9324_crossings(const struct sx9324_sample *samples, size_t n,
+	enum sx9324_field field, const int16_t threshold[SX9324_LIB_PHASES],
+	uint8_t up[], uint8_t down[]);
+
+#endif
@@ -19,15 +19,40 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 #define DEBUG
 
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/fs.h>
 #include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
 #include <linux/i2c.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
+#include <linux/kref.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/pm_wakeup.h>
+#include <linux/poll.h>
 #include <linux/regmap.h>
 #include <linux/regulator/consumer.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "sx9324.h"
 
 #define DRIVER_NAME "sx9324"
 
@@ -42,6 +67,8 @@
 #define  SX9324_PROG1IRQ		BIT(1)
 #define  SX9324_PROG0IRQ		BIT(0)
 #define SX9324_STAT_0		0x01
+#define  SX9324_STEADYSTAT		GENMASK(7, 4)
+#define  SX9324_PROXSTAT		GENMASK(3, 0)
 #define SX9324_STAT_1		0x02
 #define SX9324_STAT_2		0x03
 #define SX9324_STAT_3		0x04
@@ -136,8 +163,9 @@
 
 #define to_client(dev) container_of(dev, struct i2c_client, dev)
 
-/* lock to read phase data without interruption */
-static DEFINE_MUTEX(phdata_readback_lock);
+/* all the probed chips, for operations across chips */
+static LIST_HEAD(sx9324_devices);
+static DEFINE_MUTEX(sx9324_devices_lock);
 
 enum sx9324_phase {
 	PH0,
@@ -164,13 +192,282 @@ struct sx9324_phase_data {
 	struct sx9324_phase_stat stat;
 };
 
+/* chips sharing one SAR decision, e.g. one per antenna group */
+struct sx9324_group {
+	struct list_head node;
+	struct list_head members;
+	u32 id;
+	int users; /* members and open files */
+	bool close; /* close if any phase of any member is close */
+	unsigned int close_members;
+	u64 timestamp; /* boottime of the last change, in ns */
+	unsigned int seq; /* bumped on each change */
+	/* NIRQ edge and chip causing the last change, until delivered */
+	ktime_t origin;
+	struct sx9324_data *origin_member;
+	wait_queue_head_t wait;
+	char name[32];
+	struct miscdevice misc;
+};
+
+struct sx9324_group_reader {
+	struct sx9324_group *group;
+	unsigned int seq;
+};
+
+static LIST_HEAD(sx9324_groups);
+/* lock to access groups and their members */
+static DEFINE_MUTEX(sx9324_groups_lock);
+/*
+ * Joins and leaves are serialized, probes may run asynchronously: held
+ * across the group lookup, its creation and its device (de)registration.
+ * Not sx9324_groups_lock, which misc_open() takes under the misc lock.
+ */
+static DEFINE_MUTEX(sx9324_groups_join_lock);
+
+/* host side debouncing of the prox bits, applied per phase */
+struct sx9324_filter_cfg {
+	unsigned int debounce; /* consecutive samples to accept a change */
+	unsigned int holdoff_ms; /* minimum time between two decisions */
+	unsigned int hysteresis; /* proxdiff drop from close level to go far */
+};
+
+struct sx9324_prox_filter {
+	bool close; /* debounced decision */
+	unsigned int count; /* consecutive samples disagreeing with decision */
+	ktime_t last_change;
+	int close_diff; /* proxdiff when the phase was decided close */
+	bool close_diff_valid;
+	ktime_t origin; /* NIRQ edge the pending change was first seen on */
+};
+
+/* phase data as of the last acquisition */
+struct sx9324_snapshot {
+	bool is_valid;
+	ktime_t timestamp;
+	struct sx9324_phase_data phdata[SX9324_PHASES];
+};
+
+/* bus traffic of a chip, register addresses are counted as written bytes */
+struct sx9324_io_stats {
+	u64 transfers;
+	u64 messages;
+	u64 bytes_read;
+	u64 bytes_written;
+	u64 errors;
+	/* failed attempts by cause, then how they were handled */
+	u64 nacks;
+	u64 timeouts;
+	u64 arbitration_lost;
+	u64 other_errors;
+	u64 retries;
+	u64 bus_recoveries;
+	u64 chip_resets;
+};
+
+enum sx9324_io_op {
+	SX9324_OP_PROBE,
+	SX9324_OP_PHDATA_1PH, /* phase data with 1 to 4 phases enabled */
+	SX9324_OP_PHDATA_2PH,
+	SX9324_OP_PHDATA_3PH,
+	SX9324_OP_PHDATA_4PH,
+	SX9324_OP_SET_MODE,
+	SX9324_OP_IRQ,
+	SX9324_OP_REG_BATCH,
+	SX9324_IO_OPS
+};
+
+static const char * const sx9324_io_op_names[SX9324_IO_OPS] = {
+	[SX9324_OP_PROBE] = "probe",
+	[SX9324_OP_PHDATA_1PH] = "phdata_1ph",
+	[SX9324_OP_PHDATA_2PH] = "phdata_2ph",
+	[SX9324_OP_PHDATA_3PH] = "phdata_3ph",
+	[SX9324_OP_PHDATA_4PH] = "phdata_4ph",
+	[SX9324_OP_SET_MODE] = "set_mode",
+	[SX9324_OP_IRQ] = "irq",
+	[SX9324_OP_REG_BATCH] = "reg_batch",
+};
+
+/* bus traffic and time spent by the calls of one operation */
+struct sx9324_io_profile {
+	u64 count;
+	struct sx9324_io_stats stats;
+	u64 time_ns;
+};
+
+struct sx9324_io_mark {
+	struct sx9324_io_stats stats;
+	ktime_t start;
+};
+
+#define SX9324_LATENCY_SAMPLES 256
+
+/* latencies from the NIRQ edge, in us, the latest samples are kept */
+struct sx9324_latency {
+	u32 samples[SX9324_LATENCY_SAMPLES];
+	unsigned int count;
+};
+
+/* phase data samples kept for the chip device, must be a power of 2 */
+#define SX9324_SAMPLES 1024
+
+/* running sums, mean and variance are shown in 1/256 counts */
+#define SX9324_STATS_FRAC	8
+#define SX9324_HIST_BINS	32
+/* proxdiff counts per histogram bin, set through noise_bin_width */
+#define SX9324_NOISE_BIN_WIDTH_MAX	U16_MAX
+
+struct sx9324_running_stats {
+	u64 count;
+	s64 sum;
+	u64 sumsq;
+	s16 min;
+	s16 max;
+};
+
+struct sx9324_noise {
+	struct sx9324_running_stats useful;
+	struct sx9324_running_stats diff;
+	/* proxdiff in bins of bin_width centered on 0, edges take the rest */
+	u32 hist[SX9324_HIST_BINS];
+};
+
+/*
+ * Samples streamed through the chip device. Open files hold a reference,
+ * the chip is unbound from under them: drv_data is cleared under
+ * chip_lock and readers see a hangup.
+ */
+struct sx9324_stream {
+	struct kref ref;
+	struct rw_semaphore chip_lock;
+	struct sx9324_data *drv_data;
+	spinlock_t samples_lock;
+	u64 samples_head;
+	wait_queue_head_t samples_wait;
+	struct sx9324_sample samples[SX9324_SAMPLES];
+};
+
+enum sx9324_operational_mode {
+	SX9324_ACTIVE,
+	SX9324_DOZE,
+	SX9324_SLEEP
+};
+
+/* register traffic captured, must be a power of 2 */
+#define SX9324_TRACE_RECORDS 65536
+
 struct sx9324_data {
 	struct i2c_client *client;
+	/* the adapter only does SMBus, transfers are run as block commands */
+	bool smbus;
 	struct regmap *regmap;
 	struct gpio_desc *nirq_gpio;
 	int nirq;
-	struct workqueue_struct *workqueue;
-	struct work_struct nirq_work;
+	/* NIRQ service thread, its scheduling class and CPUs set by sysfs/DT */
+	struct kthread_worker *worker;
+	int sched_class;
+	struct cpumask worker_cpus;
+	struct kthread_work nirq_work;
+	/* without a usable NIRQ the chip is polled, faster while near */
+	bool polling;
+	struct hrtimer poll_timer;
+	struct kthread_work poll_work;
+	unsigned int poll_interval_ms;
+	/* NIRQ faster than storm_rate per second falls back to polling */
+	unsigned int storm_rate;
+	unsigned int irq_count;
+	ktime_t irq_window;
+	bool storm;
+	unsigned int storm_hold_ms;
+	/* polls of the current hold, those that found CLOSEANY/FARANY */
+	unsigned int storm_polls;
+	unsigned int storm_events;
+	ktime_t storm_end;
+	u32 storms;
+	struct kthread_work storm_work;
+	struct kthread_delayed_work storm_end_work;
+	/* lock to read phase data without interruption */
+	struct mutex phdata_lock;
+	/* acquire phase data once per conversion, on CONVDONE */
+	bool convdone_sampling;
+	unsigned int convdone_users;
+	/* interrupt sources demanded by consumers, IRQ_MSK is their union */
+	struct mutex irq_lock;
+	unsigned int irq_demand[8];
+	u8 irq_user_sources;
+	int irq_msk;
+	/* readers fetch the snapshot lock-free, writers hold acquire_lock */
+	struct sx9324_snapshot snapshot;
+	seqlock_t snapshot_lock;
+	/* readers arriving during an acquisition share its result */
+	struct mutex acquire_lock;
+	unsigned int acquire_seq;
+	int acquire_error;
+	/* every acquired snapshot, streamed through the chip device */
+	struct sx9324_stream *stream;
+	/* noise statistics of every acquired sample, since the last reset */
+	struct sx9324_noise noise[SX9324_PHASES];
+	u32 noise_bin_width;
+	u32 noise_bin_width_next;
+	spinlock_t noise_lock;
+	char misc_name[32];
+	struct miscdevice misc;
+	/* snapshot is re-used if younger, 0 for one scan period */
+	unsigned int phdata_max_age_ms;
+	unsigned int scan_period_ms;
+	struct list_head node;
+	/* software defaults, sx9324_reg_defaults tuned by the device tree */
+	struct reg_default *reg_defaults;
+	int num_reg_defaults;
+	/* "semtech,reg-init" as written, repeated paged registers included */
+	struct reg_default *reg_init;
+	int num_reg_init;
+	/* proximity state of phases, bit n for phase n, 1 means close */
+	u8 prox_state;
+	struct sx9324_filter_cfg filter_cfg;
+	struct sx9324_prox_filter filter[SX9324_PHASES];
+	unsigned int filter_hysteresis; /* close_diff was recorded with */
+	/* re-sample prox bits while a filter decision is pending */
+	struct kthread_delayed_work filter_work;
+	struct sx9324_group *group;
+	struct list_head group_node;
+	/* time of the NIRQ edge being serviced and of the undelivered event */
+	ktime_t irq_time;
+	ktime_t event_origin;
+	spinlock_t latency_lock;
+	struct sx9324_latency service_latency;
+	struct sx9324_latency delivery_latency;
+	spinlock_t io_lock;
+	struct sx9324_io_stats io_stats;
+	/* transfers failed in a row after retries, escalated by bus_work */
+	unsigned int io_failures;
+	struct kthread_work bus_work;
+	/* capture of the register traffic, NULL when not capturing */
+	struct sx9324_trace_record *trace;
+	unsigned int trace_head;
+	unsigned int trace_tail;
+	u64 trace_dropped;
+	ktime_t trace_start;
+	struct mutex trace_lock;
+	struct sx9324_io_profile io_profile[SX9324_IO_OPS];
+	/* bus cost model, on top of the bit time at the modelled bus speed */
+	u32 model_xfer_ns;
+	u32 model_byte_ns;
+	struct dentry *debugfs;
+	/* NIRQ edges while suspended are serviced on resume */
+	bool suspended;
+	bool irq_pending;
+	/* chip state replaced while suspended as a wakeup source */
+	bool wake_armed;
+	enum sx9324_operational_mode saved_mode;
+	/* a chip reset not requested by the driver is recovered from cache */
+	bool resetting;
+	u8 saved_offset[SX9324_PHASES][2];
+	u8 saved_offset_valid;
+	unsigned int recoveries;
+	unsigned int recovery_failures;
+	s64 recovery_last_us;
+	s64 recovery_max_us;
 	/* host dependent power control */
 	struct regulator *pullup;
 	bool pullup_enabled;
@@ -183,12 +480,6 @@ enum sx9324_reset_source {
 	SOFTWARE_RESET
 };
 
-enum sx9324_operational_mode {
-	SX9324_ACTIVE,
-	SX9324_DOZE,
-	SX9324_SLEEP
-};
-
 static const struct reg_default sx9324_reg_defaults[] = {
 	{ SX9324_IRQ_MSK,       SX9324_CLOSEANYIRQEN | SX9324_FARANYIRQEN },
 	{ SX9324_GNRL_CTRL_0,   0x45 }, /* Tscan=10ms, Tdoze=8xTscan */
@@ -234,11 +525,13 @@ static int sx9324_enable_vdd(struct device *dev, bool enable)
 static bool sx9324_get_software_default(struct device *dev, int reg,
 	unsigned int *val)
 {
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
 	int i = 0;
 
-	while (i < ARRAY_SIZE(sx9324_reg_defaults)) {
-		if (sx9324_reg_defaults[i].reg == reg) {
-			*val = sx9324_reg_defaults[i].def;
+	while (i < drv_data->num_reg_defaults) {
+		if (drv_data->reg_defaults[i].reg == reg) {
+			*val = drv_data->reg_defaults[i].def;
 			return true;
 		}
 		i++;
@@ -246,214 +539,782 @@ static bool sx9324_get_software_default(struct device *dev, int reg,
 	return false;
 }
 
+static int sx9324_write_software_default(struct sx9324_data *drv_data,
+	const struct reg_default *def)
+{
+	int error;
+
+	error = regmap_write(drv_data->regmap, def->reg, def->def);
+	if (error)
+		pr_err("failed to write register '0x%02x' with software default "
+			"value, err=%d\n", def->reg, error);
+	return error;
+}
+
+static bool sx9324_in_reg_init(struct sx9324_data *drv_data, unsigned int reg)
+{
+	int i;
+
+	for (i = 0; i < drv_data->num_reg_init; i++) {
+		if (drv_data->reg_init[i].reg == reg)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Write the software defaults left to sx9324_reg_defaults, then the writes
+ * of "semtech,reg-init" in the order given, as a register paged through
+ * PHASE_SEL may be written once per phase. GNRL_CTRL_1 goes last with its
+ * final value so phases are enabled once configured.
+ */
 static int sx9324_reset_software_default(struct device *dev)
 {
 	struct sx9324_data *drv_data =
 		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	struct reg_default ctrl = { .reg = SX9324_GNRL_CTRL_1 };
 	int i;
 	int error = 0;
 
-	for (i = 0; i < ARRAY_SIZE(sx9324_reg_defaults); i++) {
-		error = regmap_write(drv_data->regmap, sx9324_reg_defaults[i].reg,
-			sx9324_reg_defaults[i].def);
-		if (error) {
-			pr_err("failed to write register '0x%02x' with software default "
-				"value, err=%d\n", sx9324_reg_defaults[i].reg, error);
-			break;
-		}
+	for (i = 0; i < drv_data->num_reg_defaults && !error; i++) {
+		if (drv_data->reg_defaults[i].reg != SX9324_GNRL_CTRL_1 &&
+			!sx9324_in_reg_init(drv_data, drv_data->reg_defaults[i].reg))
+			error = sx9324_write_software_default(drv_data,
+				&drv_data->reg_defaults[i]);
+	}
+
+	for (i = 0; i < drv_data->num_reg_init && !error; i++) {
+		if (drv_data->reg_init[i].reg != SX9324_GNRL_CTRL_1)
+			error = sx9324_write_software_default(drv_data,
+				&drv_data->reg_init[i]);
 	}
+
+	if (!error && sx9324_get_software_default(dev, ctrl.reg, &ctrl.def))
+		error = sx9324_write_software_default(drv_data, &ctrl);
 	return error;
 }
 
+static void sx9324_io_begin(struct sx9324_data *drv_data,
+	struct sx9324_io_mark *mark)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	mark->stats = drv_data->io_stats;
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+	mark->start = ktime_get();
+}
+
+/*
+ * Charge the bus traffic since sx9324_io_begin() to an operation. Traffic
+ * of operations running concurrently is charged to both of them.
+ */
+static void sx9324_io_end(struct sx9324_data *drv_data, enum sx9324_io_op op,
+	const struct sx9324_io_mark *mark)
+{
+	struct sx9324_io_profile *profile = &drv_data->io_profile[op];
+	s64 time_ns = ktime_to_ns(ktime_sub(ktime_get(), mark->start));
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	profile->count++;
+	profile->stats.transfers += drv_data->io_stats.transfers -
+		mark->stats.transfers;
+	profile->stats.messages += drv_data->io_stats.messages -
+		mark->stats.messages;
+	profile->stats.bytes_read += drv_data->io_stats.bytes_read -
+		mark->stats.bytes_read;
+	profile->stats.bytes_written += drv_data->io_stats.bytes_written -
+		mark->stats.bytes_written;
+	profile->stats.errors += drv_data->io_stats.errors - mark->stats.errors;
+	profile->time_ns += time_ns;
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+}
+
+static void sx9324_latency_add(struct sx9324_data *drv_data,
+	struct sx9324_latency *latency, ktime_t origin)
+{
+	s64 us = ktime_us_delta(ktime_get(), origin);
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->latency_lock, flags);
+	latency->samples[latency->count++ % SX9324_LATENCY_SAMPLES] =
+		clamp_val(us, 0, U32_MAX);
+	spin_unlock_irqrestore(&drv_data->latency_lock, flags);
+}
+
+/* the first reader of an event accounts its delivery to userspace */
+static void sx9324_latency_delivered(struct sx9324_data *drv_data)
+{
+	unsigned long flags;
+	ktime_t origin;
+
+	spin_lock_irqsave(&drv_data->latency_lock, flags);
+	origin = drv_data->event_origin;
+	drv_data->event_origin = 0;
+	spin_unlock_irqrestore(&drv_data->latency_lock, flags);
+
+	if (origin)
+		sx9324_latency_add(drv_data, &drv_data->delivery_latency, origin);
+}
+
+static int sx9324_i2c_transfer(struct sx9324_data *drv_data,
+	struct i2c_msg msgs[], int num, bool idempotent);
+
+/*
+ * Select a phase and read len bytes of its read back from reg on, in one
+ * combined transfer. The adapter is locked once per phase and other devices
+ * on the bus get in between phases, never within one. PHASE_SEL is volatile
+ * so bypassing regmap leaves no stale cache behind.
+ */
+static int sx9324_read_phase(struct sx9324_data *drv_data, int phase,
+	u8 reg, u8 *buf, size_t len)
+{
+	struct i2c_client *client = drv_data->client;
+	u8 sel[2] = { SX9324_PHASE_SEL, phase };
+	struct i2c_msg msgs[3] = {
+		{
+			.addr = client->addr,
+			.flags = client->flags & I2C_M_TEN,
+			.len = sizeof(sel),
+			.buf = sel,
+		},
+		{
+			.addr = client->addr,
+			.flags = client->flags & I2C_M_TEN,
+			.len = 1,
+			.buf = &reg,
+		},
+		{
+			.addr = client->addr,
+			.flags = (client->flags & I2C_M_TEN) | I2C_M_RD,
+			.len = len,
+			.buf = buf,
+		},
+	};
+
+	return sx9324_i2c_transfer(drv_data, msgs, ARRAY_SIZE(msgs), true);
+}
+
 static int sx9324_read_phdata(struct device *dev,
 	struct sx9324_phase_data phdata[])
 {
 	struct sx9324_data *drv_data =
 		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
 	unsigned int val;
-	unsigned int stat0, stat1, stat2;
-	unsigned int msb, lsb;
+	u8 stat[3];
+	u8 buf[6];
+	struct sx9324_io_mark mark;
 	int error;
 	int i;
 
 	for (i = PH0; i < SX9324_PHASES; i++)
 		phdata[i].is_valid = false;
 
+	sx9324_io_begin(drv_data, &mark);
+
 	error = regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_1, &val);
 	if (error)
 		return error;
 
-	mutex_lock(&phdata_readback_lock);
+	mutex_lock(&drv_data->phdata_lock);
 	if (val & SX9324_PHEN) {
-		error = regmap_read(drv_data->regmap, SX9324_STAT_0, &stat0);
-		error |= regmap_read(drv_data->regmap, SX9324_STAT_1, &stat1);
-		error |= regmap_read(drv_data->regmap, SX9324_STAT_2, &stat2);
+		error = regmap_bulk_read(drv_data->regmap, SX9324_STAT_0, stat,
+			sizeof(stat));
+		if (error)
+			pr_err("failed to read status, err=%d\n", error);
 		for (i = PH0; i < SX9324_PHASES && !error; i++) {
 			/* an enabled phase */
 			if ((val >> i) & 0x01) {
-				error = regmap_write(drv_data->regmap, SX9324_PHASE_SEL, i);
-				if (error)
-					break;
-
-				error = regmap_read(drv_data->regmap, SX9324_USE_MSB, &msb);
-				error |= regmap_read(drv_data->regmap, SX9324_USE_LSB, &lsb);
-				if (error)
+				/* PROXUSEFUL, PROXAVG and PROXDIFF are adjacent */
+				error = sx9324_read_phase(drv_data, i, SX9324_USE_MSB, buf,
+					sizeof(buf));
+				if (error) {
+					pr_err("failed to read phase %d, err=%d\n", i, error);
 					break;
+				}
 				/* must type-cast to short to be signed */
-				phdata[i].proxuseful = (short)((msb << 8) | lsb);
-
-				error = regmap_read(drv_data->regmap, SX9324_AVG_MSB, &msb);
-				error |= regmap_read(drv_data->regmap, SX9324_AVG_LSB, &lsb);
-				if (error)
-					break;
-				phdata[i].proxavg = (short)((msb << 8) | lsb);
-
-				error = regmap_read(drv_data->regmap, SX9324_DIFF_MSB, &msb);
-				error |= regmap_read(drv_data->regmap, SX9324_DIFF_LSB, &lsb);
-				if (error)
-					break;
-				phdata[i].proxdiff = (short)((msb << 8) | lsb);
+				phdata[i].proxuseful = (short)((buf[0] << 8) | buf[1]);
+				phdata[i].proxavg = (short)((buf[2] << 8) | buf[3]);
+				phdata[i].proxdiff = (short)((buf[4] << 8) | buf[5]);
 
-				phdata[i].stat.steady = (stat0 >> (i + 4)) & 0x01;
-				phdata[i].stat.prox = (stat0 >> i) & 0x01;
-				phdata[i].stat.table = (stat1 >> (i + 4)) & 0x01;
-				phdata[i].stat.body = (stat1 >> i) & 0x01;
-				phdata[i].stat.fail = (stat2 >> (i + 4)) & 0x01;
-				phdata[i].stat.comp = (stat2 >> i) & 0x01;
+				phdata[i].stat.steady = (stat[0] >> (i + 4)) & 0x01;
+				phdata[i].stat.prox = (stat[0] >> i) & 0x01;
+				phdata[i].stat.table = (stat[1] >> (i + 4)) & 0x01;
+				phdata[i].stat.body = (stat[1] >> i) & 0x01;
+				phdata[i].stat.fail = (stat[2] >> (i + 4)) & 0x01;
+				phdata[i].stat.comp = (stat[2] >> i) & 0x01;
 
 				phdata[i].is_valid = true;
 			}
 		}
 	}
-	mutex_unlock(&phdata_readback_lock);
+	mutex_unlock(&drv_data->phdata_lock);
+
+	if (val & SX9324_PHEN)
+		sx9324_io_end(drv_data, SX9324_OP_PHDATA_1PH +
+			hweight8(val & SX9324_PHEN) - 1, &mark);
 
 	return error;
 }
 
-static int sx9324_get_mode(struct device *dev,
-	enum sx9324_operational_mode *mode)
+/* exact sums, O(1) per sample, the moments are derived when shown */
+static void sx9324_stats_add(struct sx9324_running_stats *stats, s16 val)
 {
-	struct sx9324_data *drv_data =
-		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	if (!stats->count || val < stats->min)
+		stats->min = val;
+	if (!stats->count || val > stats->max)
+		stats->max = val;
+
+	stats->count++;
+	stats->sum += val;
+	stats->sumsq += (u32)(val * val);
+}
+
+static void sx9324_noise_add(struct sx9324_data *drv_data,
+	const struct sx9324_phase_data phdata[])
+{
+	struct sx9324_noise *noise;
+	/* bounded by SX9324_NOISE_BIN_WIDTH_MAX, signed for the bins below 0 */
+	int width = drv_data->noise_bin_width;
+	unsigned long flags;
+	int diff, bin;
+	int i;
+
+	spin_lock_irqsave(&drv_data->noise_lock, flags);
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if (!phdata[i].is_valid)
+			continue;
+		noise = &drv_data->noise[i];
+		sx9324_stats_add(&noise->useful, phdata[i].proxuseful);
+		sx9324_stats_add(&noise->diff, phdata[i].proxdiff);
+
+		/* rounded down, bin 16 holds [0, width) */
+		diff = phdata[i].proxdiff;
+		bin = diff >= 0 ? diff / width : -((width - 1 - diff) / width);
+		bin += SX9324_HIST_BINS / 2;
+		noise->hist[clamp(bin, 0, SX9324_HIST_BINS - 1)]++;
+	}
+	spin_unlock_irqrestore(&drv_data->noise_lock, flags);
+}
+
+static void sx9324_push_sample(struct sx9324_data *drv_data,
+	const struct sx9324_phase_data phdata[], ktime_t timestamp)
+{
+	struct sx9324_stream *stream = drv_data->stream;
+	struct sx9324_sample sample;
+	unsigned long flags;
+	int i;
+
+	memset(&sample, 0, sizeof(sample));
+	sample.timestamp_ns = ktime_to_ns(timestamp);
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if (!phdata[i].is_valid)
+			continue;
+		sample.useful[i] = phdata[i].proxuseful;
+		sample.avg[i] = phdata[i].proxavg;
+		sample.diff[i] = phdata[i].proxdiff;
+		sample.valid |= BIT(i);
+		sample.steady |= phdata[i].stat.steady << i;
+		sample.prox |= phdata[i].stat.prox << i;
+		sample.table |= phdata[i].stat.table << i;
+		sample.body |= phdata[i].stat.body << i;
+		sample.fail |= phdata[i].stat.fail << i;
+		sample.comp |= phdata[i].stat.comp << i;
+	}
+
+	spin_lock_irqsave(&stream->samples_lock, flags);
+	stream->samples[stream->samples_head % SX9324_SAMPLES] = sample;
+	stream->samples_head++;
+	spin_unlock_irqrestore(&stream->samples_lock, flags);
+
+	wake_up_interruptible(&stream->samples_wait);
+
+	sx9324_noise_add(drv_data, phdata);
+}
+
+/*
+ * Read phase data from the chip and keep it as the latest snapshot. Callers
+ * arriving while a readback is in flight wait for it and take its result
+ * instead of repeating the same bus sequence, unless @fresh asks for data
+ * read after the call, as a conversion interrupt does.
+ */
+static int sx9324_acquire_snapshot(struct sx9324_data *drv_data,
+	struct sx9324_phase_data phdata[], bool fresh)
+{
+	struct sx9324_phase_data data[SX9324_PHASES];
+	unsigned int seq = READ_ONCE(drv_data->acquire_seq);
+	ktime_t timestamp;
 	int error;
-	unsigned int val;
 
-	error = regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_1, &val);
+	mutex_lock(&drv_data->acquire_lock);
+	if (!fresh && drv_data->acquire_seq != seq) {
+		/* completed while waiting, the snapshot is not older than us */
+		error = drv_data->acquire_error;
+		if (!error && phdata)
+			memcpy(phdata, drv_data->snapshot.phdata,
+				sizeof(drv_data->snapshot.phdata));
+		mutex_unlock(&drv_data->acquire_lock);
+		return error;
+	}
+
+	timestamp = ktime_get();
+	error = sx9324_read_phdata(&drv_data->client->dev, data);
 	if (!error) {
-		if (val & SX9324_PHEN) {
-			error = regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_0, &val);
-			if (!error) {
-				if (val & SX9324_DOZEPERIOD)
-					*mode = SX9324_DOZE;
-				else
-					*mode = SX9324_ACTIVE;
-			}
-		} else {
-			*mode = SX9324_SLEEP;
-		}
+		write_seqlock(&drv_data->snapshot_lock);
+		memcpy(drv_data->snapshot.phdata, data, sizeof(data));
+		drv_data->snapshot.timestamp = timestamp;
+		drv_data->snapshot.is_valid = true;
+		write_sequnlock(&drv_data->snapshot_lock);
+		if (phdata)
+			memcpy(phdata, data, sizeof(data));
+		sx9324_push_sample(drv_data, data, timestamp);
 	}
+	drv_data->acquire_error = error;
+	WRITE_ONCE(drv_data->acquire_seq, drv_data->acquire_seq + 1);
+	mutex_unlock(&drv_data->acquire_lock);
 
 	return error;
 }
 
-static int sx9324_set_mode(struct device *dev,
-	enum sx9324_operational_mode mode)
+/* get the latest snapshot if it is not older than max_age */
+static bool sx9324_get_snapshot(struct sx9324_data *drv_data,
+	struct sx9324_phase_data phdata[], ktime_t max_age)
 {
-	struct sx9324_data *drv_data =
-		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	ktime_t now = ktime_get();
+	unsigned int seq;
+	bool is_valid;
+
+	do {
+		seq = read_seqbegin(&drv_data->snapshot_lock);
+		is_valid = drv_data->snapshot.is_valid &&
+			ktime_sub(now, drv_data->snapshot.timestamp) <= max_age;
+		if (is_valid)
+			memcpy(phdata, drv_data->snapshot.phdata,
+				sizeof(drv_data->snapshot.phdata));
+	} while (read_seqretry(&drv_data->snapshot_lock, seq));
+
+	return is_valid;
+}
+
+/* conversions a snapshot kept up on CONVDONE may miss before it is stale */
+#define SX9324_CONVDONE_MAX_AGE_SCANS	4
+
+/*
+ * Read phase data for consumers not needing it fresher than the configured
+ * max-age, which saves the bus from readers polling at any rate.
+ */
+static int sx9324_read_phdata_cached(struct sx9324_data *drv_data,
+	struct sx9324_phase_data phdata[])
+{
+	unsigned int max_age_ms;
+
+	/*
+	 * snapshot is kept up to date on every conversion, unless storming,
+	 * one a few conversions old means CONVDONE went missing
+	 */
+	max_age_ms = max(drv_data->scan_period_ms, 1U) *
+		SX9324_CONVDONE_MAX_AGE_SCANS;
+	if (READ_ONCE(drv_data->convdone_users) && !READ_ONCE(drv_data->storm) &&
+		sx9324_get_snapshot(drv_data, phdata, ms_to_ktime(max_age_ms)))
+		return 0;
+
+	max_age_ms = drv_data->phdata_max_age_ms ? : drv_data->scan_period_ms;
+	if (sx9324_get_snapshot(drv_data, phdata, ms_to_ktime(max_age_ms)))
+		return 0;
+
+	return sx9324_acquire_snapshot(drv_data, phdata, false);
+}
+
+/* while storming or armed for wakeup only CLOSEANY/FARANY may interrupt */
+#define SX9324_IRQ_ESSENTIAL	(SX9324_CLOSEANYIRQEN | SX9324_FARANYIRQEN)
+
+static int sx9324_irq_apply(struct sx9324_data *drv_data)
+{
+	u8 msk = 0;
 	int error;
-	unsigned int val;
+	int i;
 
-	switch (mode) {
-		case SX9324_ACTIVE:
-		case SX9324_DOZE:
-			if (!sx9324_get_software_default(dev, SX9324_GNRL_CTRL_1, &val))
-				val = 0x0f; /* all phases enabled if no software default set */
-			error = regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_1,
-				SX9324_PHEN, val);
-			if (mode == SX9324_ACTIVE) {
-				error |= regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_0,
-					SX9324_DOZEPERIOD, 0);
-			} else {
-				if (!sx9324_get_software_default(dev, SX9324_GNRL_CTRL_0, &val))
-					val = 0x40; /* Tdoze=8xTscan if no software default set */
-				error |= regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_0,
-					SX9324_DOZEPERIOD, val);
-			}
-			break;
-		case SX9324_SLEEP:
-			error = regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_1,
-				SX9324_PHEN, 0);
-			break;
-		default:
-			error = -EINVAL;
-			break;
+	for (i = 0; i < ARRAY_SIZE(drv_data->irq_demand); i++) {
+		if (drv_data->irq_demand[i])
+			msk |= BIT(i);
 	}
+	if (drv_data->storm || drv_data->wake_armed)
+		msk &= SX9324_IRQ_ESSENTIAL;
 
+	if (msk == drv_data->irq_msk)
+		return 0;
+
+	error = regmap_write(drv_data->regmap, SX9324_IRQ_MSK, msk);
+	if (!error)
+		WRITE_ONCE(drv_data->irq_msk, msk);
 	return error;
 }
 
-static int sx9324_reset(struct device *dev, enum sx9324_reset_source src)
+/*
+ * Take a reference on the sources in get and drop one on those in put,
+ * then program IRQ_MSK. References are given back if it fails.
+ */
+static int sx9324_irq_demand_locked(struct sx9324_data *drv_data, u8 get,
+	u8 put)
 {
-	struct sx9324_data *drv_data =
-		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
-	unsigned int val;
-	int ret;
+	int error;
+	int i;
 
-	if (src == POWER_UP_RESET) {
-		pr_debug("performed power up reset\n");
-	} else if (src == SOFTWARE_RESET) {
-		pr_debug("performed software reset\n");
-		ret = regmap_write(drv_data->regmap, SX9324_RESET, 0xde);
-		if (ret) {
-			pr_err("failed to perform a software reset, err=%d\n", ret);
-			return ret;
-		}
+	for (i = 0; i < ARRAY_SIZE(drv_data->irq_demand); i++) {
+		if (get & BIT(i))
+			drv_data->irq_demand[i]++;
+		if ((put & BIT(i)) && drv_data->irq_demand[i])
+			drv_data->irq_demand[i]--;
 	}
-	/* maximum power-up time, spec says 1ms, but not enough */
-	udelay(3000);
 
-	if (0 == gpiod_get_value(drv_data->nirq_gpio)) {
-		/* clear NIRQ status and the chip is ready for operation */
-		ret = regmap_read(drv_data->regmap, SX9324_IRQ_SRC, &val);
-		if (ret) {
-			pr_err("chip is not ready for operation, err=%d", ret);
-			return ret;
-		} else {
-			if (1 != gpiod_get_value(drv_data->nirq_gpio)) {
-				pr_err("failed to reset the chip\n");
-				return -ENODEV;
-			}
+	error = sx9324_irq_apply(drv_data);
+	if (error) {
+		for (i = 0; i < ARRAY_SIZE(drv_data->irq_demand); i++) {
+			if (get & BIT(i))
+				drv_data->irq_demand[i]--;
+			if (put & BIT(i))
+				drv_data->irq_demand[i]++;
 		}
-	} else {
-		/* NIRQ handler has cleared the status */
-		pr_debug("NIRQ has already been cleared, software reset performed?\n");
 	}
 
-	return 0;
+	return error;
 }
 
-static bool sx9324_writeable_reg(struct device *dev, unsigned int reg)
+static int sx9324_irq_demand(struct sx9324_data *drv_data, u8 get, u8 put)
 {
-	switch (reg) {
-		case SX9324_IRQ_MSK ... SX9324_IRQ_CFG_2:
-		case SX9324_GNRL_CTRL_0:
-		case SX9324_GNRL_CTRL_1:
-		case SX9324_I2C_ADDR:
-		case SX9324_CLK_SPRD:
-		case SX9324_AFE_CTRL_0:
-		case SX9324_AFE_CTRL_3:
-		case SX9324_AFE_CTRL_4:
-		case SX9324_AFE_CTRL_6 ... SX9324_AFE_CTRL_9:
-		case SX9324_PROX_CTRL_0 ... SX9324_PROX_CTRL_7:
-		case SX9324_ADV_CTRL_0 ... SX9324_ADV_CTRL_20:
-		case SX9324_PHASE_SEL:
-		case SX9324_OFFSET_MSB:
-		case SX9324_OFFSET_LSB:
-		case SX9324_RESET:
-			return true;
-		default:
-			return false;
+	int error;
+
+	mutex_lock(&drv_data->irq_lock);
+	error = sx9324_irq_demand_locked(drv_data, get, put);
+	mutex_unlock(&drv_data->irq_lock);
+
+	return error;
+}
+
+/* re-program IRQ_MSK after a change of the storm or wakeup state */
+static int sx9324_irq_update(struct sx9324_data *drv_data)
+{
+	int error;
+
+	mutex_lock(&drv_data->irq_lock);
+	error = sx9324_irq_apply(drv_data);
+	mutex_unlock(&drv_data->irq_lock);
+
+	return error;
+}
+
+/*
+ * The sources the software defaults enable are demanded for good, they
+ * feed the prox pipeline.
+ */
+static int sx9324_irq_init(struct sx9324_data *drv_data)
+{
+	unsigned int msk;
+	int error;
+
+	error = regmap_read(drv_data->regmap, SX9324_IRQ_MSK, &msk);
+	if (error)
+		return error;
+
+	drv_data->irq_msk = msk;
+	return sx9324_irq_demand(drv_data, msk, 0);
+}
+
+/*
+ * Phase data is acquired on CONVDONE while the convdone attribute, the
+ * irq_mask attribute or an open sample stream reader wants it.
+ */
+static int sx9324_convdone_demand_locked(struct sx9324_data *drv_data,
+	bool get)
+{
+	int error;
+
+	if (get) {
+		error = sx9324_irq_demand_locked(drv_data, SX9324_CONVDONEIRQEN, 0);
+		if (!error)
+			WRITE_ONCE(drv_data->convdone_users,
+				drv_data->convdone_users + 1);
+	} else {
+		error = sx9324_irq_demand_locked(drv_data, 0, SX9324_CONVDONEIRQEN);
+		WRITE_ONCE(drv_data->convdone_users, drv_data->convdone_users - 1);
+	}
+
+	return error;
+}
+
+static int sx9324_convdone_demand(struct sx9324_data *drv_data, bool get)
+{
+	bool idle;
+	int error;
+
+	mutex_lock(&drv_data->irq_lock);
+	error = sx9324_convdone_demand_locked(drv_data, get);
+	idle = !drv_data->convdone_users;
+	mutex_unlock(&drv_data->irq_lock);
+
+	/* the snapshot is no longer kept up to date */
+	if (idle) {
+		mutex_lock(&drv_data->acquire_lock);
+		write_seqlock(&drv_data->snapshot_lock);
+		drv_data->snapshot.is_valid = false;
+		write_sequnlock(&drv_data->snapshot_lock);
+		mutex_unlock(&drv_data->acquire_lock);
+	}
+
+	return error;
+}
+
+static int sx9324_enable_convdone_sampling(struct device *dev, bool enable)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	int error;
+
+	if (drv_data->convdone_sampling == enable)
+		return 0;
+
+	error = sx9324_convdone_demand(drv_data, enable);
+	if (!error || !enable)
+		drv_data->convdone_sampling = enable;
+
+	return error;
+}
+
+struct sx9324_batch_item {
+	struct sx9324_data *drv_data;
+	struct sx9324_phase_data phdata[SX9324_PHASES];
+	int error;
+};
+
+struct sx9324_batch_work {
+	struct work_struct work;
+	struct i2c_adapter *adapter;
+	struct sx9324_batch_item *items;
+	int count;
+};
+
+static void sx9324_batch_worker(struct work_struct *work)
+{
+	struct sx9324_batch_work *batch = container_of(work,
+		struct sx9324_batch_work, work);
+	struct sx9324_batch_item *item;
+	int i;
+
+	/* chips on the same adapter can only be read one after another */
+	for (i = 0; i < batch->count; i++) {
+		item = &batch->items[i];
+		if (item->drv_data->client->adapter == batch->adapter)
+			item->error = sx9324_read_phdata(&item->drv_data->client->dev,
+				item->phdata);
+	}
+}
+
+/*
+ * Read phase data of several chips with one work item per adapter running
+ * concurrently, so it takes as long as the slowest adapter rather than the
+ * sum of all the chips.
+ */
+static int sx9324_read_phdata_batch(struct sx9324_batch_item items[],
+	int count)
+{
+	struct sx9324_batch_work *batches;
+	struct i2c_adapter *adapter;
+	int nbatches = 0;
+	int i, j;
+
+	batches = kcalloc(count, sizeof(*batches), GFP_KERNEL);
+	if (!batches)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		adapter = items[i].drv_data->client->adapter;
+		for (j = 0; j < nbatches; j++) {
+			if (batches[j].adapter == adapter)
+				break;
+		}
+		if (j < nbatches)
+			continue;
+
+		batches[nbatches].adapter = adapter;
+		batches[nbatches].items = items;
+		batches[nbatches].count = count;
+		INIT_WORK(&batches[nbatches].work, sx9324_batch_worker);
+		queue_work(system_unbound_wq, &batches[nbatches].work);
+		nbatches++;
+	}
+
+	for (j = 0; j < nbatches; j++)
+		flush_work(&batches[j].work);
+
+	kfree(batches);
+	return 0;
+}
+
+static int sx9324_get_mode(struct device *dev,
+	enum sx9324_operational_mode *mode)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	int error;
+	unsigned int val;
+
+	error = regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_1, &val);
+	if (!error) {
+		if (val & SX9324_PHEN) {
+			error = regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_0, &val);
+			if (!error) {
+				if (val & SX9324_DOZEPERIOD)
+					*mode = SX9324_DOZE;
+				else
+					*mode = SX9324_ACTIVE;
+			}
+		} else {
+			*mode = SX9324_SLEEP;
+		}
+	}
+
+	return error;
+}
+
+static int sx9324_update_scan_period(struct device *dev)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	int error;
+	unsigned int val;
+
+	error = regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_0, &val);
+	if (!error) {
+		/* Tscan = 2ms x SCANPERIOD, the minimum is used for 0 */
+		drv_data->scan_period_ms = max(2 * (val & SX9324_SCANPERIOD), 1U);
+	}
+
+	return error;
+}
+
+static int sx9324_set_mode(struct device *dev,
+	enum sx9324_operational_mode mode)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	struct sx9324_io_mark mark;
+	int error;
+	unsigned int val;
+
+	sx9324_io_begin(drv_data, &mark);
+	switch (mode) {
+		case SX9324_ACTIVE:
+		case SX9324_DOZE:
+			if (!sx9324_get_software_default(dev, SX9324_GNRL_CTRL_1, &val))
+				val = 0x0f; /* all phases enabled if no software default set */
+			error = regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_1,
+				SX9324_PHEN, val);
+			if (mode == SX9324_ACTIVE) {
+				error |= regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_0,
+					SX9324_DOZEPERIOD, 0);
+			} else {
+				if (!sx9324_get_software_default(dev, SX9324_GNRL_CTRL_0, &val))
+					val = 0x40; /* Tdoze=8xTscan if no software default set */
+				error |= regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_0,
+					SX9324_DOZEPERIOD, val);
+			}
+			break;
+		case SX9324_SLEEP:
+			error = regmap_update_bits(drv_data->regmap, SX9324_GNRL_CTRL_1,
+				SX9324_PHEN, 0);
+			break;
+		default:
+			error = -EINVAL;
+			break;
+	}
+	sx9324_io_end(drv_data, SX9324_OP_SET_MODE, &mark);
+
+	return error;
+}
+
+static int sx9324_reset(struct device *dev, enum sx9324_reset_source src)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	unsigned int val;
+	int ret;
+
+	if (src == POWER_UP_RESET) {
+		pr_debug("performed power up reset\n");
+	} else if (src == SOFTWARE_RESET) {
+		pr_debug("performed software reset\n");
+		WRITE_ONCE(drv_data->resetting, true);
+		ret = regmap_write(drv_data->regmap, SX9324_RESET, 0xde);
+		if (ret) {
+			pr_err("failed to perform a software reset, err=%d\n", ret);
+			WRITE_ONCE(drv_data->resetting, false);
+			return ret;
+		}
+		/* the chip is back to hardware defaults, so is the cache */
+		regcache_drop_region(drv_data->regmap, SX9324_IRQ_SRC, SX9324_REV);
+		drv_data->saved_offset_valid = 0;
+		WRITE_ONCE(drv_data->irq_msk, -1);
+	}
+	/* maximum power-up time, spec says 1ms, but not enough */
+	udelay(3000);
+
+	ret = 0;
+	if (!drv_data->nirq_gpio) {
+		/* NIRQ not wired, clear the status regardless */
+		ret = regmap_read(drv_data->regmap, SX9324_IRQ_SRC, &val);
+		if (ret)
+			pr_err("chip is not ready for operation, err=%d", ret);
+	} else if (0 == gpiod_get_value(drv_data->nirq_gpio)) {
+		/* clear NIRQ status and the chip is ready for operation */
+		ret = regmap_read(drv_data->regmap, SX9324_IRQ_SRC, &val);
+		if (ret) {
+			pr_err("chip is not ready for operation, err=%d", ret);
+		} else {
+			if (1 != gpiod_get_value(drv_data->nirq_gpio)) {
+				pr_err("failed to reset the chip\n");
+				ret = -ENODEV;
+			}
+		}
+	} else {
+		/* NIRQ handler has cleared the status */
+		pr_debug("NIRQ has already been cleared, software reset performed?\n");
+	}
+
+	if (src == SOFTWARE_RESET) {
+		/* IRQ_MSK is back to its hardware default, program the demand */
+		if (!ret) {
+			ret = sx9324_irq_update(drv_data);
+			if (ret)
+				pr_err("failed to restore the interrupt sources, err=%d\n",
+					ret);
+		}
+		WRITE_ONCE(drv_data->resetting, false);
+	}
+	return ret;
+}
+
+static bool sx9324_writeable_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+		case SX9324_IRQ_MSK ... SX9324_IRQ_CFG_2:
+		case SX9324_GNRL_CTRL_0:
+		case SX9324_GNRL_CTRL_1:
+		case SX9324_I2C_ADDR:
+		case SX9324_CLK_SPRD:
+		case SX9324_AFE_CTRL_0:
+		case SX9324_AFE_CTRL_3:
+		case SX9324_AFE_CTRL_4:
+		case SX9324_AFE_CTRL_6 ... SX9324_AFE_CTRL_9:
+		case SX9324_PROX_CTRL_0 ... SX9324_PROX_CTRL_7:
+		case SX9324_ADV_CTRL_0 ... SX9324_ADV_CTRL_20:
+		case SX9324_PHASE_SEL:
+		case SX9324_OFFSET_MSB:
+		case SX9324_OFFSET_LSB:
+		case SX9324_RESET:
+			return true;
+		default:
+			return false;
 	}
 }
 
@@ -480,48 +1341,319 @@ static bool sx9324_readable_reg(struct device *dev, unsigned int reg)
 	}
 }
 
-static const struct regmap_config sx9324_regmap_config = {
-	.reg_bits = 8,
-	.val_bits = 8,
-	.writeable_reg = sx9324_writeable_reg,
-	.readable_reg = sx9324_readable_reg,
-	.cache_type	= REGCACHE_NONE,
-};
+static void sx9324_trace_add(struct sx9324_data *drv_data, u32 time_us,
+	u8 reg, u8 val, u8 flags)
+{
+	struct sx9324_trace_record *rec;
 
-#define MAX_DUMPING_REGISTERS 8
-#define REGISTER_UNSET_VALUE 0xff
-static unsigned int dumping_regs[MAX_DUMPING_REGISTERS];
+	if (drv_data->trace_head - drv_data->trace_tail >= SX9324_TRACE_RECORDS) {
+		drv_data->trace_dropped++;
+		return;
+	}
 
-static ssize_t sx9324_registers_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+	rec = &drv_data->trace[drv_data->trace_head++ % SX9324_TRACE_RECORDS];
+	rec->time_us = time_us;
+	rec->reg = reg;
+	rec->val = val;
+	rec->flags = flags;
+	rec->reserved = 0;
+}
+
+/*
+ * Record a transfer register by register, relying on the register address
+ * auto-increment of the chip for bursts. Called with io_lock held.
+ */
+static void sx9324_trace_transfer(struct sx9324_data *drv_data,
+	const struct i2c_msg msgs[], int num)
 {
-	struct sx9324_data *drv_data =
-		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
-	unsigned int val;
-	int written = 0;
-	int i;
-	int error;
+	u32 time_us = ktime_us_delta(ktime_get(), drv_data->trace_start);
+	u8 reg = 0;
+	int i, k;
 
-	for (i = 0; i < MAX_DUMPING_REGISTERS; i++) {
-		written += sprintf(buf + written, "0x%02x: ", dumping_regs[i]);
-		if (dumping_regs[i] != REGISTER_UNSET_VALUE) {
-			error = regmap_read(drv_data->regmap, dumping_regs[i], &val);
-			if (error)
-				pr_err("failed reading register '0x%02x', err=%d\n",
-					dumping_regs[i], error);
-			else
-				written += sprintf(buf + written, "0x%02x", val);
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			for (k = 0; k < msgs[i].len; k++)
+				sx9324_trace_add(drv_data, time_us, reg++, msgs[i].buf[k],
+					SX9324_TRACE_READ);
+		} else if (msgs[i].len) {
+			reg = msgs[i].buf[0];
+			for (k = 1; k < msgs[i].len; k++)
+				sx9324_trace_add(drv_data, time_us, reg++, msgs[i].buf[k],
+					SX9324_TRACE_WRITE);
 		}
-		written += sprintf(buf + written, "\n");
 	}
-
-	return written;
 }
 
-static ssize_t sx9324_registers_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t count)
+/* every transfer to the chip goes through here to be accounted */
+#define SX9324_IO_RETRIES		3
+#define SX9324_IO_BACKOFF_US	200
+/* transfers failed in a row before recovering the bus, resetting the chip */
+#define SX9324_BUS_RECOVERY_FAILURES	3
+#define SX9324_CHIP_RESET_FAILURES		6
+
+static void sx9324_count_error(struct sx9324_io_stats *stats, int err)
 {
-	struct sx9324_data *drv_data =
+	stats->errors++;
+	switch (err) {
+		case -ENXIO:
+		case -EREMOTEIO:
+			stats->nacks++;
+			break;
+		case -ETIMEDOUT:
+			stats->timeouts++;
+			break;
+		case -EAGAIN:
+			stats->arbitration_lost++;
+			break;
+		default:
+			stats->other_errors++;
+			break;
+	}
+}
+
+/*
+ * Run the messages of a transfer as SMBus I2C block commands. A write is
+ * <reg data...> and a read follows a write of the register pointer, longer
+ * blocks are split relying on the register auto-increment. Unlike
+ * i2c_transfer() the messages are not atomic as a whole, callers serialize
+ * paged accesses with phdata_lock.
+ */
+static int sx9324_smbus_xfer(struct i2c_client *client, struct i2c_msg msgs[],
+	int num)
+{
+	u8 reg = 0;
+	u16 pos, len;
+	int ret;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			for (pos = 0; pos < msgs[i].len; pos += len) {
+				len = min_t(u16, msgs[i].len - pos, I2C_SMBUS_BLOCK_MAX);
+				ret = i2c_smbus_read_i2c_block_data(client, reg + pos, len,
+					msgs[i].buf + pos);
+				if (ret < 0)
+					return ret;
+				if (ret != len)
+					return -EIO;
+			}
+		} else {
+			if (!msgs[i].len)
+				return -EINVAL;
+			reg = msgs[i].buf[0];
+			/* a register pointer alone is sent with the next read */
+			for (pos = 1; pos < msgs[i].len; pos += len) {
+				len = min_t(u16, msgs[i].len - pos, I2C_SMBUS_BLOCK_MAX);
+				ret = i2c_smbus_write_i2c_block_data(client, reg + pos - 1,
+					len, msgs[i].buf + pos);
+				if (ret < 0)
+					return ret;
+			}
+		}
+	}
+
+	return num;
+}
+
+/*
+ * Transfer with retries, 200us backoff doubled on each attempt. A transfer
+ * NACKed on the address did not reach the chip and is always retried, any
+ * other error only if the transfer is idempotent.
+ */
+static int sx9324_i2c_transfer(struct sx9324_data *drv_data,
+	struct i2c_msg msgs[], int num, bool idempotent)
+{
+	unsigned long flags;
+	size_t bytes_read = 0;
+	size_t bytes_written = 0;
+	unsigned int backoff_us = SX9324_IO_BACKOFF_US;
+	bool escalate = false;
+	int attempt;
+	int ret;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_RD)
+			bytes_read += msgs[i].len;
+		else
+			bytes_written += msgs[i].len;
+	}
+
+	for (attempt = 0; ; attempt++) {
+		if (drv_data->smbus)
+			ret = sx9324_smbus_xfer(drv_data->client, msgs, num);
+		else
+			ret = i2c_transfer(drv_data->client->adapter, msgs, num);
+		if (ret >= 0 && ret != num)
+			ret = -EIO;
+
+		spin_lock_irqsave(&drv_data->io_lock, flags);
+		drv_data->io_stats.transfers++;
+		drv_data->io_stats.messages += num;
+		drv_data->io_stats.bytes_read += bytes_read;
+		drv_data->io_stats.bytes_written += bytes_written;
+		if (ret < 0) {
+			sx9324_count_error(&drv_data->io_stats, ret);
+		} else {
+			drv_data->io_failures = 0;
+			if (drv_data->trace)
+				sx9324_trace_transfer(drv_data, msgs, num);
+		}
+		spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+		if (ret >= 0)
+			return 0;
+		if (attempt == SX9324_IO_RETRIES || (ret != -ENXIO && !idempotent))
+			break;
+
+		spin_lock_irqsave(&drv_data->io_lock, flags);
+		drv_data->io_stats.retries++;
+		spin_unlock_irqrestore(&drv_data->io_lock, flags);
+		usleep_range(backoff_us, backoff_us * 2);
+		backoff_us *= 2;
+	}
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	drv_data->io_failures++;
+	escalate = drv_data->io_failures == SX9324_BUS_RECOVERY_FAILURES ||
+		drv_data->io_failures == SX9324_CHIP_RESET_FAILURES;
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+	pr_err("transfer failed after %d attempts, err=%d\n", attempt + 1, ret);
+	if (escalate)
+		kthread_queue_work(drv_data->worker, &drv_data->bus_work);
+
+	return ret;
+}
+
+static int sx9324_regmap_read(void *context, const void *reg, size_t reg_size,
+	void *val, size_t val_size)
+{
+	struct sx9324_data *drv_data = context;
+	struct i2c_client *client = drv_data->client;
+	struct i2c_msg msgs[2] = {
+		{
+			.addr = client->addr,
+			.flags = client->flags & I2C_M_TEN,
+			.len = reg_size,
+			.buf = (u8 *)reg,
+		},
+		{
+			.addr = client->addr,
+			.flags = (client->flags & I2C_M_TEN) | I2C_M_RD,
+			.len = val_size,
+			.buf = val,
+		},
+	};
+
+	/* IRQ_SRC is cleared on read, reading it again may lose events */
+	return sx9324_i2c_transfer(drv_data, msgs, ARRAY_SIZE(msgs),
+		*(u8 *)reg != SX9324_IRQ_SRC);
+}
+
+static int sx9324_regmap_write(void *context, const void *data, size_t count)
+{
+	struct sx9324_data *drv_data = context;
+	struct i2c_client *client = drv_data->client;
+	struct i2c_msg msg = {
+		.addr = client->addr,
+		.flags = client->flags & I2C_M_TEN,
+		.len = count,
+		.buf = (u8 *)data,
+	};
+
+	return sx9324_i2c_transfer(drv_data, &msg, 1, false);
+}
+
+/* same as the regmap I2C bus, with the bus traffic accounted */
+static const struct regmap_bus sx9324_regmap_bus = {
+	.write = sx9324_regmap_write,
+	.read = sx9324_regmap_read,
+};
+
+/* status, read back and read-only registers are never cached */
+static bool sx9324_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+		case SX9324_PHASE_SEL ... SX9324_SAR_LSB:
+		case SX9324_RESET:
+			return true;
+		default:
+			return !sx9324_writeable_reg(dev, reg);
+	}
+}
+
+static const struct regmap_config sx9324_regmap_config = {
+	.reg_bits = 8,
+	.val_bits = 8,
+	.max_register = SX9324_REV,
+	.writeable_reg = sx9324_writeable_reg,
+	.readable_reg = sx9324_readable_reg,
+	.volatile_reg = sx9324_volatile_reg,
+	.cache_type	= REGCACHE_RBTREE,
+};
+
+/*
+ * Offsets are not cached, the register pair is paged by PHASE_SEL. Keep
+ * the ones written by hand to restore them after an unexpected reset.
+ */
+static void sx9324_save_offset_locked(struct sx9324_data *drv_data,
+	unsigned int reg, unsigned int val)
+{
+	unsigned int phase;
+
+	if (regmap_read(drv_data->regmap, SX9324_PHASE_SEL, &phase))
+		return;
+	phase &= 0x07;
+	if (phase >= SX9324_PHASES)
+		return;
+
+	drv_data->saved_offset[phase][reg - SX9324_OFFSET_MSB] = val;
+	drv_data->saved_offset_valid |= BIT(phase * 2 + reg - SX9324_OFFSET_MSB);
+}
+
+static void sx9324_save_offset(struct sx9324_data *drv_data, unsigned int reg,
+	unsigned int val)
+{
+	mutex_lock(&drv_data->phdata_lock);
+	sx9324_save_offset_locked(drv_data, reg, val);
+	mutex_unlock(&drv_data->phdata_lock);
+}
+
+#define MAX_DUMPING_REGISTERS 8
+#define REGISTER_UNSET_VALUE 0xff
+static unsigned int dumping_regs[MAX_DUMPING_REGISTERS];
+
+static ssize_t sx9324_registers_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	unsigned int val;
+	int written = 0;
+	int i;
+	int error;
+
+	for (i = 0; i < MAX_DUMPING_REGISTERS; i++) {
+		written += sprintf(buf + written, "0x%02x: ", dumping_regs[i]);
+		if (dumping_regs[i] != REGISTER_UNSET_VALUE) {
+			error = regmap_read(drv_data->regmap, dumping_regs[i], &val);
+			if (error)
+				pr_err("failed reading register '0x%02x', err=%d\n",
+					dumping_regs[i], error);
+			else
+				written += sprintf(buf + written, "0x%02x", val);
+		}
+		written += sprintf(buf + written, "\n");
+	}
+
+	return written;
+}
+
+static ssize_t sx9324_registers_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
 		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
 	unsigned int val;
 	int i = 0;
@@ -583,177 +1715,2463 @@ static ssize_t sx9324_registers_store(struct device *dev,
 				*reg_val = '\0';
 			}
 
-			error = kstrtouint(reg_str, 16, &reg_offset);
-			if (error == 0) {
-				dumping_regs[j] = reg_offset;
-				pr_info("register 0x%02x is stored to be dumped\n",
-					dumping_regs[j]);
-				if (to_write) {
-					error = regmap_write(drv_data->regmap, dumping_regs[j],
-						write_value);
-					if (error)
-						pr_err("failed writing register 0x%02x with value "
-							"0x%02x, err=%d\n", dumping_regs[j], write_value,
-							error);
-					else
-						pr_info("successfully wrote register 0x%02x with "
-							"value 0x%02x\n", dumping_regs[j], write_value);
-				}
-			}
-		}
+			error = kstrtouint(reg_str, 16, &reg_offset);
+			if (error == 0) {
+				dumping_regs[j] = reg_offset;
+				pr_info("register 0x%02x is stored to be dumped\n",
+					dumping_regs[j]);
+				if (to_write) {
+					error = regmap_write(drv_data->regmap, dumping_regs[j],
+						write_value);
+					if (error)
+						pr_err("failed writing register 0x%02x with value "
+							"0x%02x, err=%d\n", dumping_regs[j], write_value,
+							error);
+					else
+						pr_info("successfully wrote register 0x%02x with "
+							"value 0x%02x\n", dumping_regs[j], write_value);
+					if (dumping_regs[j] == SX9324_GNRL_CTRL_0)
+						sx9324_update_scan_period(dev);
+					if (!error && (dumping_regs[j] == SX9324_OFFSET_MSB ||
+						dumping_regs[j] == SX9324_OFFSET_LSB))
+						sx9324_save_offset(drv_data, dumping_regs[j],
+							write_value);
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+static ssize_t sx9324_reset_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	sx9324_reset(dev, SOFTWARE_RESET);
+	return 0;
+}
+
+static ssize_t sx9324_phdata_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	struct sx9324_phase_data phdata[SX9324_PHASES];
+	int written = 0;
+	int i;
+	int error;
+
+	written += sprintf(buf + written, "PH Useful Avg Diff Steady Prox Table Body Fail Comp\n");
+	written += sprintf(buf + written, "===================================================\n");
+	error = sx9324_read_phdata_cached(drv_data, phdata);
+	if (!error) {
+		for (i = PH0; i < SX9324_PHASES; i++) {
+			if (phdata[i].is_valid) {
+				written += sprintf(buf + written, "%d %d %d %d %d %d %d %d %d %d\n", i,
+					phdata[i].proxuseful, phdata[i].proxavg, phdata[i].proxdiff,
+					phdata[i].stat.steady, phdata[i].stat.prox, phdata[i].stat.table,
+					phdata[i].stat.body, phdata[i].stat.fail, phdata[i].stat.comp);
+			}
+		}
+	}
+	return written;
+}
+
+static ssize_t sx9324_mode_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	enum sx9324_operational_mode mode;
+	int written = 0;
+	int error;
+
+	error = sx9324_get_mode(dev, &mode);
+	if (!error) {
+		written += sprintf(buf + written, "%c active\n",
+			mode == SX9324_ACTIVE ? 'v' : ' ');
+		written += sprintf(buf + written, "%c doze\n",
+			mode == SX9324_DOZE ? 'v' : ' ');
+		written += sprintf(buf + written, "%c sleep\n",
+			mode == SX9324_SLEEP ? 'v' : ' ');
+	} else {
+		*buf = '\0';
+	}
+
+	return written;
+}
+
+static ssize_t sx9324_mode_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	if (buf && count != 0) {
+		if (0 == strncmp(buf, "active", 6))
+			sx9324_set_mode(dev, SX9324_ACTIVE);
+		else if (0 == strncmp(buf, "doze", 4))
+			sx9324_set_mode(dev, SX9324_DOZE);
+		else if (0 == strncmp(buf, "sleep", 5))
+			sx9324_set_mode(dev, SX9324_SLEEP);
+	}
+
+	return count;
+}
+
+static ssize_t sx9324_prox_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	u8 prox = READ_ONCE(drv_data->prox_state);
+	int written = 0;
+	int i;
+
+	sx9324_latency_delivered(drv_data);
+
+	written += sprintf(buf + written, "PH Prox\n");
+	written += sprintf(buf + written, "=======\n");
+	for (i = PH0; i < SX9324_PHASES; i++)
+		written += sprintf(buf + written, "%d %d\n", i, (prox >> i) & 0x01);
+
+	return written;
+}
+
+static ssize_t sx9324_debounce_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+
+	return sprintf(buf, "debounce=%u holdoff_ms=%u hysteresis=%u\n",
+		drv_data->filter_cfg.debounce, drv_data->filter_cfg.holdoff_ms,
+		drv_data->filter_cfg.hysteresis);
+}
+
+static ssize_t sx9324_debounce_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	struct sx9324_filter_cfg cfg;
+
+	pr_info("usage: echo \"debounce holdoff_ms hysteresis\" > debounce\n");
+
+	if (buf && count != 0) {
+		if (sscanf(buf, "%u %u %u", &cfg.debounce, &cfg.holdoff_ms,
+			&cfg.hysteresis) != 3 || cfg.debounce == 0)
+			return -EINVAL;
+		drv_data->filter_cfg = cfg;
+	}
+
+	return count;
+}
+
+static ssize_t sx9324_convdone_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+
+	return sprintf(buf, "%d\n", drv_data->convdone_sampling ? 1 : 0);
+}
+
+static ssize_t sx9324_convdone_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	bool enable;
+	int error;
+
+	error = kstrtobool(buf, &enable);
+	if (error)
+		return error;
+
+	error = sx9324_enable_convdone_sampling(dev, enable);
+	if (error) {
+		pr_err("failed to %s CONVDONE sampling, err=%d\n",
+			enable ? "enable" : "disable", error);
+		return error;
+	}
+
+	return count;
+}
+
+static ssize_t sx9324_phdata_max_age_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+
+	return sprintf(buf, "%u\n", drv_data->phdata_max_age_ms);
+}
+
+static ssize_t sx9324_phdata_max_age_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	unsigned int ms;
+	int error;
+
+	error = kstrtouint(buf, 0, &ms);
+	if (error)
+		return error;
+
+	drv_data->phdata_max_age_ms = ms;
+	return count;
+}
+
+enum sx9324_sched_class {
+	SX9324_SCHED_NORMAL,
+	SX9324_SCHED_FIFO_LOW,
+	SX9324_SCHED_FIFO,
+};
+
+static const char * const sx9324_sched_class_names[] = {
+	[SX9324_SCHED_NORMAL] = "normal",
+	[SX9324_SCHED_FIFO_LOW] = "fifo_low",
+	[SX9324_SCHED_FIFO] = "fifo",
+};
+
+/*
+ * The kernel picks the real-time priority, a specific one is left to the
+ * admin (chrt on the thread).
+ */
+static void sx9324_set_sched(struct sx9324_data *drv_data, int sched_class)
+{
+	struct task_struct *task = drv_data->worker->task;
+
+	switch (sched_class) {
+		case SX9324_SCHED_FIFO:
+			sched_set_fifo(task);
+			break;
+		case SX9324_SCHED_FIFO_LOW:
+			sched_set_fifo_low(task);
+			break;
+		default:
+			sched_set_normal(task, 0);
+			break;
+	}
+
+	drv_data->sched_class = sched_class;
+}
+
+static int sx9324_set_worker_cpus(struct sx9324_data *drv_data,
+	const struct cpumask *cpus)
+{
+	int error;
+
+	error = set_cpus_allowed_ptr(drv_data->worker->task, cpus);
+	if (error)
+		return error;
+
+	cpumask_copy(&drv_data->worker_cpus, cpus);
+	return 0;
+}
+
+static ssize_t sx9324_irq_sched_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+
+	return sprintf(buf, "%s\n",
+		sx9324_sched_class_names[drv_data->sched_class]);
+}
+
+/* scheduling of the NIRQ service thread, "normal", "fifo_low" or "fifo" */
+static ssize_t sx9324_irq_sched_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	int sched_class;
+
+	sched_class = sysfs_match_string(sx9324_sched_class_names, buf);
+	if (sched_class < 0)
+		return sched_class;
+
+	sx9324_set_sched(drv_data, sched_class);
+	return count;
+}
+
+static ssize_t sx9324_irq_cpus_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+
+	return sprintf(buf, "%*pbl\n", cpumask_pr_args(&drv_data->worker_cpus));
+}
+
+/* CPUs the NIRQ service thread may run on, as a list, e.g. "2-3" */
+static ssize_t sx9324_irq_cpus_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	cpumask_var_t cpus;
+	int error;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	error = cpulist_parse(buf, cpus);
+	if (!error && !cpumask_intersects(cpus, cpu_online_mask))
+		error = -EINVAL;
+	if (!error)
+		error = sx9324_set_worker_cpus(drv_data, cpus);
+	free_cpumask_var(cpus);
+
+	if (error) {
+		pr_err("failed to set the service thread CPUs, err=%d\n", error);
+		return error;
+	}
+
+	return count;
+}
+
+static ssize_t sx9324_irq_storm_rate_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+
+	return sprintf(buf, "%u\n", drv_data->storm_rate);
+}
+
+/* NIRQ edges per second before falling back to polling, 0 to never */
+static ssize_t sx9324_irq_storm_rate_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	unsigned int rate;
+	int error;
+
+	error = kstrtouint(buf, 0, &rate);
+	if (error)
+		return error;
+
+	WRITE_ONCE(drv_data->storm_rate, rate);
+	return count;
+}
+
+static ssize_t sx9324_irq_mask_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+
+	return sprintf(buf, "0x%02x\n", drv_data->irq_user_sources);
+}
+
+/*
+ * Interrupt sources userspace wants on top of those the driver needs, as
+ * the IRQ_MSK bits in hex. The registers attribute shows what IRQ_MSK is.
+ * Only the sources the driver services are accepted, CONVDONE acquires
+ * phase data as the convdone attribute does.
+ */
+#define SX9324_IRQ_DELIVERED	(SX9324_IRQ_ESSENTIAL | SX9324_CONVDONEIRQEN)
+
+static ssize_t sx9324_irq_mask_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	u8 old, sources, convdone;
+	int error;
+
+	error = kstrtou8(buf, 16, &sources);
+	if (error)
+		return error;
+	if (sources & ~SX9324_IRQ_DELIVERED)
+		return -EINVAL;
+
+	mutex_lock(&drv_data->irq_lock);
+	old = drv_data->irq_user_sources;
+	convdone = (old ^ sources) & SX9324_CONVDONEIRQEN;
+	if (convdone)
+		error = sx9324_convdone_demand_locked(drv_data,
+			sources & SX9324_CONVDONEIRQEN);
+	if (!error) {
+		error = sx9324_irq_demand_locked(drv_data,
+			sources & ~old & ~convdone, old & ~sources & ~convdone);
+		if (error && convdone)
+			sx9324_convdone_demand_locked(drv_data,
+				!(sources & SX9324_CONVDONEIRQEN));
+	}
+	if (!error)
+		drv_data->irq_user_sources = sources;
+	mutex_unlock(&drv_data->irq_lock);
+
+	if (error) {
+		pr_err("failed to set interrupt sources, err=%d\n", error);
+		return error;
+	}
+
+	return count;
+}
+
+static ssize_t sx9324_irq_cfg_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	u8 cfg[3];
+	int error;
+
+	error = regmap_bulk_read(drv_data->regmap, SX9324_IRQ_CFG_0, cfg,
+		sizeof(cfg));
+	if (error)
+		return error;
+
+	return sprintf(buf, "0x%02x 0x%02x 0x%02x\n", cfg[0], cfg[1], cfg[2]);
+}
+
+/* NIRQ behaviour, "<IRQ_CFG_0> <IRQ_CFG_1> <IRQ_CFG_2>" in hex */
+static ssize_t sx9324_irq_cfg_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	unsigned int val[3];
+	u8 cfg[3];
+	int error;
+	int i;
+
+	if (sscanf(buf, "%x %x %x", &val[0], &val[1], &val[2]) != 3)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(cfg); i++) {
+		if (val[i] > 0xff)
+			return -EINVAL;
+		cfg[i] = val[i];
+	}
+
+	error = regmap_bulk_write(drv_data->regmap, SX9324_IRQ_CFG_0, cfg,
+		sizeof(cfg));
+	if (error) {
+		pr_err("failed to write IRQ_CFG, err=%d\n", error);
+		return error;
+	}
+
+	return count;
+}
+
+static struct device_attribute sx9324_attrs[] =
+{
+	__ATTR(registers, S_IWUSR | S_IRUGO, sx9324_registers_show,
+		sx9324_registers_store),
+	__ATTR(reset, S_IRUSR, sx9324_reset_show, NULL),
+	__ATTR(phdata, S_IRUGO, sx9324_phdata_show, NULL),
+	__ATTR(mode, S_IWUSR | S_IRUGO, sx9324_mode_show, sx9324_mode_store),
+	__ATTR(prox, S_IRUGO, sx9324_prox_show, NULL),
+	__ATTR(debounce, S_IWUSR | S_IRUGO, sx9324_debounce_show,
+		sx9324_debounce_store),
+	__ATTR(convdone, S_IWUSR | S_IRUGO, sx9324_convdone_show,
+		sx9324_convdone_store),
+	__ATTR(phdata_max_age_ms, S_IWUSR | S_IRUGO, sx9324_phdata_max_age_show,
+		sx9324_phdata_max_age_store),
+	__ATTR(irq_storm_rate, S_IWUSR | S_IRUGO, sx9324_irq_storm_rate_show,
+		sx9324_irq_storm_rate_store),
+	__ATTR(irq_mask, S_IWUSR | S_IRUGO, sx9324_irq_mask_show,
+		sx9324_irq_mask_store),
+	__ATTR(irq_cfg, S_IWUSR | S_IRUGO, sx9324_irq_cfg_show,
+		sx9324_irq_cfg_store),
+	__ATTR(irq_sched, S_IWUSR | S_IRUGO, sx9324_irq_sched_show,
+		sx9324_irq_sched_store),
+	__ATTR(irq_cpus, S_IWUSR | S_IRUGO, sx9324_irq_cpus_show,
+		sx9324_irq_cpus_store),
+};
+
+static int sx9324_create_sysfs_attr(struct device *dev)
+{
+	int i;
+	int error;
+
+	for (i = 0; i < ARRAY_SIZE(sx9324_attrs); i++) {
+		error = device_create_file(dev, &sx9324_attrs[i]);
+		if (error) {
+			pr_err("failed creating device attribute files, err=%d\n", error);
+			break;
+		}
+	}
+
+	if (i < ARRAY_SIZE(sx9324_attrs)) {
+		for (i--; i >= 0; i--)
+			device_remove_file(dev, &sx9324_attrs[i]);
+	}
+
+	return error;
+}
+
+static void sx9324_remove_sysfs_attr(struct device *dev)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sx9324_attrs); i++)
+		device_remove_file(dev, &sx9324_attrs[i]);
+}
+
+static void sx9324_group_put(struct sx9324_group *group)
+{
+	mutex_lock(&sx9324_groups_lock);
+	if (--group->users == 0)
+		kfree(group);
+	mutex_unlock(&sx9324_groups_lock);
+}
+
+static int sx9324_group_open(struct inode *inode, struct file *file)
+{
+	struct sx9324_group *group = container_of(file->private_data,
+		struct sx9324_group, misc);
+	struct sx9324_group_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	mutex_lock(&sx9324_groups_lock);
+	group->users++;
+	reader->group = group;
+	/* the current decision is the first event to read */
+	reader->seq = group->seq - 1;
+	mutex_unlock(&sx9324_groups_lock);
+
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int sx9324_group_release(struct inode *inode, struct file *file)
+{
+	struct sx9324_group_reader *reader = file->private_data;
+
+	sx9324_group_put(reader->group);
+	kfree(reader);
+	return 0;
+}
+
+static ssize_t sx9324_group_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sx9324_group_reader *reader = file->private_data;
+	struct sx9324_group *group = reader->group;
+	struct sx9324_group_event event;
+	int error;
+
+	if (count < sizeof(event))
+		return -EINVAL;
+
+	if (READ_ONCE(group->seq) == reader->seq) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		error = wait_event_interruptible(group->wait,
+			READ_ONCE(group->seq) != reader->seq);
+		if (error)
+			return error;
+	}
+
+	mutex_lock(&sx9324_groups_lock);
+	event.timestamp_ns = group->timestamp;
+	event.close = group->close;
+	event.close_members = group->close_members;
+	reader->seq = group->seq;
+	if (group->origin_member && group->origin) {
+		sx9324_latency_add(group->origin_member,
+			&group->origin_member->delivery_latency, group->origin);
+		group->origin = 0;
+	}
+	mutex_unlock(&sx9324_groups_lock);
+
+	if (copy_to_user(buf, &event, sizeof(event)))
+		return -EFAULT;
+
+	return sizeof(event);
+}
+
+static unsigned int sx9324_group_poll(struct file *file, poll_table *wait)
+{
+	struct sx9324_group_reader *reader = file->private_data;
+	struct sx9324_group *group = reader->group;
+
+	poll_wait(file, &group->wait, wait);
+	if (READ_ONCE(group->seq) != reader->seq)
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+static const struct file_operations sx9324_group_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_group_open,
+	.release = sx9324_group_release,
+	.read = sx9324_group_read,
+	.poll = sx9324_group_poll,
+	.llseek = no_llseek,
+};
+
+static int sx9324_group_join(struct device *dev)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	struct sx9324_group *group;
+	bool found = false;
+	u32 id;
+	int error;
+
+	/* a chip not belonging to any group runs on its own */
+	if (of_property_read_u32(dev->of_node, "semtech,sar-group", &id))
+		return 0;
+
+	mutex_lock(&sx9324_groups_join_lock);
+	mutex_lock(&sx9324_groups_lock);
+	list_for_each_entry(group, &sx9324_groups, node) {
+		if (group->id == id) {
+			found = true;
+			break;
+		}
+	}
+	if (found) {
+		group->users++;
+		list_add_tail(&drv_data->group_node, &group->members);
+		drv_data->group = group;
+	}
+	mutex_unlock(&sx9324_groups_lock);
+	if (found) {
+		error = 0;
+		goto exit;
+	}
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group) {
+		error = -ENOMEM;
+		goto exit;
+	}
+
+	group->id = id;
+	group->users = 1;
+	group->timestamp = ktime_to_ns(ktime_get_boottime());
+	INIT_LIST_HEAD(&group->members);
+	init_waitqueue_head(&group->wait);
+	snprintf(group->name, sizeof(group->name), DRIVER_NAME "-group%u", id);
+	group->misc.minor = MISC_DYNAMIC_MINOR;
+	group->misc.name = group->name;
+	group->misc.fops = &sx9324_group_fops;
+
+	error = misc_register(&group->misc);
+	if (error) {
+		pr_err("failed to register device for group %u, err=%d\n", id, error);
+		kfree(group);
+		goto exit;
+	}
+
+	mutex_lock(&sx9324_groups_lock);
+	list_add_tail(&group->node, &sx9324_groups);
+	list_add_tail(&drv_data->group_node, &group->members);
+	drv_data->group = group;
+	mutex_unlock(&sx9324_groups_lock);
+
+exit:
+	mutex_unlock(&sx9324_groups_join_lock);
+	return error;
+}
+
+static void sx9324_group_leave(struct device *dev)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	struct sx9324_group *group = drv_data->group;
+	bool empty;
+
+	if (!group)
+		return;
+
+	mutex_lock(&sx9324_groups_join_lock);
+	mutex_lock(&sx9324_groups_lock);
+	list_del(&drv_data->group_node);
+	drv_data->group = NULL;
+	if (group->origin_member == drv_data)
+		group->origin_member = NULL;
+	empty = list_empty(&group->members);
+	if (empty)
+		list_del(&group->node);
+	mutex_unlock(&sx9324_groups_lock);
+
+	/* misc_open() holds the misc lock while taking ours */
+	if (empty)
+		misc_deregister(&group->misc);
+	mutex_unlock(&sx9324_groups_join_lock);
+	sx9324_group_put(group);
+}
+
+/*
+ * Recompute the combined decision of the group, readers are woken up only
+ * when it changes, not on every change of a member.
+ */
+static void sx9324_group_update(struct sx9324_data *drv_data,
+	ktime_t origin)
+{
+	struct sx9324_group *group = drv_data->group;
+	struct sx9324_data *member;
+	unsigned int close_members = 0;
+
+	if (!group)
+		return;
+
+	mutex_lock(&sx9324_groups_lock);
+	list_for_each_entry(member, &group->members, group_node) {
+		if (READ_ONCE(member->prox_state))
+			close_members++;
+	}
+	group->close_members = close_members;
+	if (group->close != (close_members != 0)) {
+		group->close = close_members != 0;
+		group->timestamp = ktime_to_ns(ktime_get_boottime());
+		group->seq++;
+		group->origin = origin;
+		group->origin_member = drv_data;
+		pr_debug("group %u: %s\n", group->id, group->close ? "close" : "far");
+		wake_up_interruptible(&group->wait);
+	}
+	mutex_unlock(&sx9324_groups_lock);
+}
+
+static int sx9324_io_stats_show(struct seq_file *s, void *unused)
+{
+	struct sx9324_data *drv_data = s->private;
+	struct sx9324_io_stats stats;
+	u64 trace_dropped;
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	stats = drv_data->io_stats;
+	trace_dropped = drv_data->trace_dropped;
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+	seq_printf(s, "transfers %llu\n", stats.transfers);
+	seq_printf(s, "messages %llu\n", stats.messages);
+	seq_printf(s, "bytes_read %llu\n", stats.bytes_read);
+	seq_printf(s, "bytes_written %llu\n", stats.bytes_written);
+	seq_printf(s, "errors %llu\n", stats.errors);
+	seq_printf(s, "nacks %llu\n", stats.nacks);
+	seq_printf(s, "timeouts %llu\n", stats.timeouts);
+	seq_printf(s, "arbitration_lost %llu\n", stats.arbitration_lost);
+	seq_printf(s, "other_errors %llu\n", stats.other_errors);
+	seq_printf(s, "retries %llu\n", stats.retries);
+	seq_printf(s, "bus_recoveries %llu\n", stats.bus_recoveries);
+	seq_printf(s, "chip_resets %llu\n", stats.chip_resets);
+	seq_printf(s, "trace_dropped %llu\n", trace_dropped);
+
+	return 0;
+}
+
+static int sx9324_io_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sx9324_io_stats_show, inode->i_private);
+}
+
+/* any write clears the counters, e.g. before measuring one operation */
+static ssize_t sx9324_io_stats_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct sx9324_data *drv_data =
+		((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	memset(&drv_data->io_stats, 0, sizeof(drv_data->io_stats));
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations sx9324_io_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_io_stats_open,
+	.read = seq_read,
+	.write = sx9324_io_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Modelled time of the bus traffic at a bus speed: each message costs a
+ * (repeated) start and the address byte, each transfer a stop, bytes are 9
+ * bits with the ack, plus the per-transfer and per-byte model overheads.
+ */
+static u64 sx9324_model_ns(struct sx9324_data *drv_data,
+	const struct sx9324_io_stats *stats, u32 hz)
+{
+	u64 bytes = stats->bytes_read + stats->bytes_written;
+	u64 bits = stats->messages * 10 + bytes * 9 + stats->transfers;
+
+	return div_u64(bits * NSEC_PER_SEC, hz) +
+		stats->transfers * drv_data->model_xfer_ns +
+		bytes * drv_data->model_byte_ns;
+}
+
+static int sx9324_io_profile_show(struct seq_file *s, void *unused)
+{
+	struct sx9324_data *drv_data = s->private;
+	struct sx9324_io_profile profile[SX9324_IO_OPS];
+	struct sx9324_io_stats *stats;
+	unsigned long flags;
+	u64 n;
+	int i;
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	memcpy(profile, drv_data->io_profile, sizeof(profile));
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+	/* one line of per-call averages for each measured operation */
+	for (i = 0; i < SX9324_IO_OPS; i++) {
+		n = profile[i].count;
+		if (!n)
+			continue;
+
+		stats = &profile[i].stats;
+		seq_printf(s, "op=%s count=%llu transfers=%llu messages=%llu "
+			"bytes_read=%llu bytes_written=%llu errors=%llu measured_ns=%llu "
+			"model_100khz_ns=%llu model_400khz_ns=%llu model_1mhz_ns=%llu\n",
+			sx9324_io_op_names[i], n,
+			div64_u64(stats->transfers, n), div64_u64(stats->messages, n),
+			div64_u64(stats->bytes_read, n), div64_u64(stats->bytes_written, n),
+			stats->errors, div64_u64(profile[i].time_ns, n),
+			div64_u64(sx9324_model_ns(drv_data, stats, 100000), n),
+			div64_u64(sx9324_model_ns(drv_data, stats, 400000), n),
+			div64_u64(sx9324_model_ns(drv_data, stats, 1000000), n));
+	}
+
+	return 0;
+}
+
+static int sx9324_io_profile_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sx9324_io_profile_show, inode->i_private);
+}
+
+/* any write clears the profile */
+static ssize_t sx9324_io_profile_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct sx9324_data *drv_data =
+		((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	memset(drv_data->io_profile, 0, sizeof(drv_data->io_profile));
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations sx9324_io_profile_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_io_profile_open,
+	.read = seq_read,
+	.write = sx9324_io_profile_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int sx9324_latency_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a;
+	u32 y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void sx9324_latency_report(struct seq_file *s,
+	struct sx9324_data *drv_data, const char *name,
+	const struct sx9324_latency *latency, u32 *samples)
+{
+	unsigned long flags;
+	unsigned int n;
+
+	spin_lock_irqsave(&drv_data->latency_lock, flags);
+	n = min_t(unsigned int, latency->count, SX9324_LATENCY_SAMPLES);
+	memcpy(samples, latency->samples, n * sizeof(*samples));
+	spin_unlock_irqrestore(&drv_data->latency_lock, flags);
+
+	if (!n) {
+		seq_printf(s, "path=%s samples=0\n", name);
+		return;
+	}
+
+	sort(samples, n, sizeof(*samples), sx9324_latency_cmp, NULL);
+	seq_printf(s, "path=%s samples=%u p50_us=%u p90_us=%u p99_us=%u "
+		"max_us=%u\n", name, n, samples[n * 50 / 100],
+		samples[n * 90 / 100], samples[n * 99 / 100], samples[n - 1]);
+}
+
+static int sx9324_latency_show(struct seq_file *s, void *unused)
+{
+	struct sx9324_data *drv_data = s->private;
+	u32 *samples;
+
+	samples = kmalloc_array(SX9324_LATENCY_SAMPLES, sizeof(*samples),
+		GFP_KERNEL);
+	if (!samples)
+		return -ENOMEM;
+
+	/* NIRQ edge to the end of the service, and to the first reader */
+	sx9324_latency_report(s, drv_data, "service", &drv_data->service_latency,
+		samples);
+	sx9324_latency_report(s, drv_data, "delivery",
+		&drv_data->delivery_latency, samples);
+
+	kfree(samples);
+	return 0;
+}
+
+static int sx9324_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sx9324_latency_show, inode->i_private);
+}
+
+/* any write clears the samples */
+static ssize_t sx9324_latency_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct sx9324_data *drv_data =
+		((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->latency_lock, flags);
+	drv_data->service_latency.count = 0;
+	drv_data->delivery_latency.count = 0;
+	spin_unlock_irqrestore(&drv_data->latency_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations sx9324_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_latency_open,
+	.read = seq_read,
+	.write = sx9324_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void sx9324_publish_prox(struct sx9324_data *drv_data, u8 prox,
+	ktime_t origin)
+{
+	u8 changed = drv_data->prox_state ^ prox;
+	unsigned long flags;
+	int i;
+
+	if (!changed)
+		return;
+
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if ((changed >> i) & 0x01)
+			pr_debug("phase %d: %s\n", i, (prox >> i) & 0x01 ? "close" : "far");
+	}
+	spin_lock_irqsave(&drv_data->latency_lock, flags);
+	drv_data->event_origin = origin;
+	spin_unlock_irqrestore(&drv_data->latency_lock, flags);
+
+	WRITE_ONCE(drv_data->prox_state, prox);
+	sysfs_notify(&drv_data->client->dev.kobj, NULL, "prox");
+	sx9324_group_update(drv_data, origin);
+}
+
+/*
+ * Feed one sample of raw prox bits to the per-phase filters and return the
+ * debounced decision. A phase follows the raw bit only after it has
+ * disagreed with the decision for 'debounce' consecutive samples and the
+ * hold-off time since the previous decision has elapsed. Going far also
+ * needs proxdiff to drop 'hysteresis' below its close level, for the phases
+ * in diff_mask having one. A close phase without a close level takes it from
+ * the first diff[] provided. *retry_ms is set if a phase is still pending.
+ * origin is the NIRQ edge of the sample, kept by a phase from the first
+ * sample of a change until the change is decided, see sx9324_filter_origin().
+ */
+static u8 sx9324_filter_prox(const struct sx9324_filter_cfg *cfg,
+	struct sx9324_prox_filter filter[], u8 raw, const int diff[],
+	u8 diff_mask, ktime_t origin, ktime_t now, unsigned int scan_ms,
+	unsigned int *retry_ms)
+{
+	struct sx9324_prox_filter *f;
+	u8 decision = 0;
+	s64 elapsed_ms;
+	bool close;
+	bool has_diff;
+	int i;
+
+	*retry_ms = 0;
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		f = &filter[i];
+		close = (raw >> i) & 0x01;
+		has_diff = (diff_mask >> i) & 0x01;
+		if (close == f->close)
+			f->origin = 0;
+		else if (!f->origin)
+			f->origin = origin;
+
+		if (close == f->close) {
+			f->count = 0;
+			/* decided close without proxdiff, or hysteresis enabled since */
+			if (close && has_diff && !f->close_diff_valid) {
+				f->close_diff = diff[i];
+				f->close_diff_valid = true;
+			}
+		} else if (!close && has_diff && cfg->hysteresis &&
+			f->close_diff_valid &&
+			f->close_diff - diff[i] < (int)cfg->hysteresis) {
+			/* still within hysteresis, not a valid release yet */
+			f->count = 0;
+			*retry_ms = *retry_ms ? min(*retry_ms, scan_ms) : scan_ms;
+		} else if (++f->count < max(cfg->debounce, 1U)) {
+			*retry_ms = *retry_ms ? min(*retry_ms, scan_ms) : scan_ms;
+		} else {
+			elapsed_ms = ktime_ms_delta(now, f->last_change);
+			if (f->last_change && elapsed_ms < cfg->holdoff_ms) {
+				elapsed_ms = cfg->holdoff_ms - elapsed_ms;
+				*retry_ms = *retry_ms ? min_t(unsigned int, *retry_ms,
+					elapsed_ms) : elapsed_ms;
+			} else {
+				f->close = close;
+				f->count = 0;
+				f->last_change = now;
+				f->close_diff_valid = close && has_diff;
+				if (f->close_diff_valid)
+					f->close_diff = diff[i];
+			}
+		}
+		if (f->close)
+			decision |= BIT(i);
+	}
+
+	return decision;
+}
+
+/* the earliest NIRQ edge the changed phases were first seen on, 0 if none */
+static ktime_t sx9324_filter_origin(const struct sx9324_prox_filter filter[],
+	u8 changed)
+{
+	ktime_t origin = 0;
+	int i;
+
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if (((changed >> i) & 0x01) && filter[i].origin &&
+			(!origin || filter[i].origin < origin))
+			origin = filter[i].origin;
+	}
+
+	return origin;
+}
+
+static int sx9324_read_proxdiff(struct device *dev, u8 phases, int diff[])
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	u8 buf[2];
+	int error = 0;
+	int i;
+
+	mutex_lock(&drv_data->phdata_lock);
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if (!((phases >> i) & 0x01))
+			continue;
+
+		error = sx9324_read_phase(drv_data, i, SX9324_DIFF_MSB, buf,
+			sizeof(buf));
+		if (error)
+			break;
+		diff[i] = (short)((buf[0] << 8) | buf[1]);
+	}
+	mutex_unlock(&drv_data->phdata_lock);
+
+	return error;
+}
+
+/*
+ * The chip reset itself, e.g. on a brown-out or ESD. Write back the cached
+ * registers, phases enabled last as on probe, and the saved offsets.
+ */
+static void sx9324_recover(struct sx9324_data *drv_data)
+{
+	struct regmap *regmap = drv_data->regmap;
+	ktime_t start = ktime_get();
+	unsigned int phase_sel;
+	s64 elapsed_us;
+	int i, j;
+	int error;
+
+	pr_warn("unexpected chip reset, restoring registers\n");
+
+	mutex_lock(&drv_data->phdata_lock);
+	regcache_mark_dirty(regmap);
+	error = regcache_sync_region(regmap, SX9324_IRQ_MSK, SX9324_GNRL_CTRL_0);
+	if (!error)
+		error = regcache_sync_region(regmap, SX9324_I2C_ADDR, SX9324_REV);
+	if (!error)
+		error = regmap_read(regmap, SX9324_PHASE_SEL, &phase_sel);
+	for (i = PH0; i < SX9324_PHASES && !error; i++) {
+		if (!(drv_data->saved_offset_valid & (0x03 << (i * 2))))
+			continue;
+		error = regmap_write(regmap, SX9324_PHASE_SEL, i);
+		for (j = 0; j < 2 && !error; j++) {
+			if (drv_data->saved_offset_valid & BIT(i * 2 + j))
+				error = regmap_write(regmap, SX9324_OFFSET_MSB + j,
+					drv_data->saved_offset[i][j]);
+		}
+		if (!error)
+			error = regmap_write(regmap, SX9324_PHASE_SEL, phase_sel);
+	}
+	if (!error)
+		error = regcache_sync_region(regmap, SX9324_GNRL_CTRL_1,
+			SX9324_GNRL_CTRL_1);
+
+	elapsed_us = ktime_us_delta(ktime_get(), start);
+	drv_data->recoveries++;
+	drv_data->recovery_last_us = elapsed_us;
+	if (elapsed_us > drv_data->recovery_max_us)
+		drv_data->recovery_max_us = elapsed_us;
+	if (error)
+		drv_data->recovery_failures++;
+	mutex_unlock(&drv_data->phdata_lock);
+
+	if (error)
+		pr_err("failed to restore registers after a reset, err=%d\n", error);
+	else
+		pr_info("registers restored in %lld us\n", elapsed_us);
+}
+
+/*
+ * Transfers keep failing after retries: recover the bus first, then reset
+ * the chip, by power cycle if it cannot be reached, and restore it.
+ */
+static void sx9324_bus_worker(struct kthread_work *work)
+{
+	struct sx9324_data *drv_data = container_of(work, struct sx9324_data,
+		bus_work);
+	struct device *dev = &drv_data->client->dev;
+	unsigned long flags;
+	unsigned int failures;
+	unsigned int val;
+	int error;
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	failures = drv_data->io_failures;
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+	if (failures < SX9324_CHIP_RESET_FAILURES) {
+		error = i2c_recover_bus(drv_data->client->adapter);
+		pr_warn("bus recovery after %u failed transfers, err=%d\n",
+			failures, error);
+		spin_lock_irqsave(&drv_data->io_lock, flags);
+		drv_data->io_stats.bus_recoveries++;
+		spin_unlock_irqrestore(&drv_data->io_lock, flags);
+		return;
+	}
+
+	pr_warn("chip reset after %u failed transfers\n", failures);
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	drv_data->io_stats.chip_resets++;
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+	WRITE_ONCE(drv_data->resetting, true);
+	error = regmap_write(drv_data->regmap, SX9324_RESET, 0xde);
+	if (error && drv_data->vdd_enabled) {
+		sx9324_enable_vdd(dev, false);
+		msleep(10);
+		error = sx9324_enable_vdd(dev, true);
+	}
+	/* maximum power-up time, as on sx9324_reset() */
+	udelay(3000);
+	if (!error)
+		error = regmap_read(drv_data->regmap, SX9324_IRQ_SRC, &val);
+	WRITE_ONCE(drv_data->resetting, false);
+
+	if (error) {
+		pr_err("failed to reset the chip, err=%d\n", error);
+		return;
+	}
+	sx9324_recover(drv_data);
+}
+
+/*
+ * Service the chip: sample IRQ_SRC and the prox bits and publish the
+ * filtered decision. origin is the time of the NIRQ edge being serviced,
+ * 0 for a re-sample not caused by an interrupt, such as the filter retry.
+ */
+static void sx9324_sample_prox(struct sx9324_data *drv_data, ktime_t origin)
+{
+	struct device *dev = &drv_data->client->dev;
+	struct sx9324_filter_cfg cfg = drv_data->filter_cfg;
+	int diff[SX9324_PHASES] = { 0 };
+	unsigned int retry_ms;
+	u8 buf[2];
+	u8 raw, pending, prox;
+	u8 diff_mask = 0;
+	struct sx9324_io_mark mark;
+	int i;
+	int err;
+
+	sx9324_io_begin(drv_data, &mark);
+
+	/* IRQ_SRC and STAT_0 are adjacent, fetch both in a single transfer */
+	err = regmap_bulk_read(drv_data->regmap, SX9324_IRQ_SRC, buf, sizeof(buf));
+	if (err) {
+		pr_err_ratelimited("failed to read register (SX9324_IRQ_SRC), err=%d\n",
+			err);
+		return;
+	}
+
+	/* CONVDONE alone comes with every conversion, too often to log */
+	if (buf[0] & ~SX9324_CONVDONEIRQ)
+		pr_debug("IRQ SRC: 0x%02x; Reset=%d, Close=%d, Far=%d\n", buf[0],
+			buf[0] & SX9324_RESETIRQ ? 1 : 0,
+			buf[0] & SX9324_CLOSEANYIRQ ? 1 : 0,
+			buf[0] & SX9324_FARANYIRQ ? 1 : 0);
+
+	if ((buf[0] & SX9324_RESETIRQ) && !READ_ONCE(drv_data->resetting))
+		sx9324_recover(drv_data);
+
+	/* IRQ_SRC latches what NIRQ would have reported, a storm's activity */
+	if (READ_ONCE(drv_data->storm)) {
+		drv_data->storm_polls++;
+		if (buf[0] & (SX9324_CLOSEANYIRQ | SX9324_FARANYIRQ))
+			drv_data->storm_events++;
+	}
+
+	if ((buf[0] & SX9324_CONVDONEIRQ) && READ_ONCE(drv_data->convdone_users)) {
+		/* a readback in flight may predate the conversion, read it */
+		err = sx9324_acquire_snapshot(drv_data, NULL, true);
+		if (err)
+			pr_err_ratelimited("failed to acquire phase data, err=%d\n",
+				err);
+	}
+
+	/* a close level recorded under another hysteresis is not trusted */
+	if (cfg.hysteresis != drv_data->filter_hysteresis) {
+		for (i = PH0; i < SX9324_PHASES; i++)
+			drv_data->filter[i].close_diff_valid = false;
+		drv_data->filter_hysteresis = cfg.hysteresis;
+	}
+
+	/*
+	 * proxdiff is only needed for the phases about to change and for the
+	 * close phases still missing their close level
+	 */
+	raw = buf[1] & SX9324_PROXSTAT;
+	pending = 0;
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if (drv_data->filter[i].close != ((raw >> i) & 0x01) ||
+			(drv_data->filter[i].close &&
+			!drv_data->filter[i].close_diff_valid))
+			pending |= BIT(i);
+	}
+
+	if (cfg.hysteresis && pending && !sx9324_read_proxdiff(dev, pending, diff))
+		diff_mask = pending;
+
+	prox = sx9324_filter_prox(&cfg, drv_data->filter, raw, diff, diff_mask,
+		origin, ktime_get(), drv_data->scan_period_ms, &retry_ms);
+	/* a debounced change is timed from the edge it was first seen on */
+	sx9324_publish_prox(drv_data, prox, sx9324_filter_origin(drv_data->filter,
+		prox ^ drv_data->prox_state));
+
+	if (retry_ms)
+		kthread_mod_delayed_work(drv_data->worker, &drv_data->filter_work,
+			msecs_to_jiffies(retry_ms));
+
+	sx9324_io_end(drv_data, SX9324_OP_IRQ, &mark);
+}
+
+static void sx9324_filter_worker(struct kthread_work *work)
+{
+	struct sx9324_data *drv_data = container_of(work, struct sx9324_data,
+		filter_work.work);
+
+	sx9324_sample_prox(drv_data, 0);
+}
+
+static void sx9324_nirq_worker(struct kthread_work *work) {
+	struct sx9324_data *drv_data = container_of(work, struct sx9324_data,
+		nirq_work);
+	ktime_t origin = READ_ONCE(drv_data->irq_time);
+
+	sx9324_sample_prox(drv_data, origin);
+	sx9324_latency_add(drv_data, &drv_data->service_latency, origin);
+	pm_relax(&drv_data->client->dev);
+}
+
+/* CLOSE/FAR at half the default 100 Hz scan rate is a storm */
+#define SX9324_STORM_RATE		50
+#define SX9324_STORM_HOLD_MS	5000
+#define SX9324_STORM_HOLD_MAX_MS	60000
+
+/*
+ * Count NIRQ edges per second. CONVDONE interrupts at the scan rate on
+ * purpose, those edges are allowed on top of the rate.
+ */
+static bool sx9324_irq_storm(struct sx9324_data *drv_data, ktime_t now)
+{
+	unsigned int rate = READ_ONCE(drv_data->storm_rate);
+
+	if (!rate)
+		return false;
+	if (READ_ONCE(drv_data->irq_msk) & SX9324_CONVDONEIRQEN)
+		rate += MSEC_PER_SEC / max(READ_ONCE(drv_data->scan_period_ms), 1U);
+
+	if (ktime_ms_delta(now, drv_data->irq_window) >= MSEC_PER_SEC) {
+		drv_data->irq_window = now;
+		drv_data->irq_count = 0;
+	}
+
+	return ++drv_data->irq_count > rate;
+}
+
+/* kthread_work has no work_pending(), a queued work is on the worker list */
+static bool sx9324_work_pending(struct kthread_work *work)
+{
+	return !list_empty(&work->node);
+}
+
+static irqreturn_t sx9324_nirq_handler(int irq, void *p)
+{
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(p);
+	ktime_t now = ktime_get();
+
+	/* an edge coalesced into pending work keeps the earliest time */
+	if (!sx9324_work_pending(&drv_data->nirq_work) && !drv_data->irq_pending)
+		WRITE_ONCE(drv_data->irq_time, now);
+
+	/* keep the system awake until the event is published */
+	pm_stay_awake(&drv_data->client->dev);
+	if (READ_ONCE(drv_data->suspended)) {
+		/* the bus may not be usable yet, service it on resume */
+		drv_data->irq_pending = true;
+		return IRQ_HANDLED;
+	}
+
+	if (sx9324_irq_storm(drv_data, now)) {
+		/* polled until the storm ends, this edge is still serviced */
+		WRITE_ONCE(drv_data->storm, true);
+		disable_irq_nosync(irq);
+		kthread_queue_work(drv_data->worker, &drv_data->storm_work);
+	}
+
+	kthread_queue_work(drv_data->worker, &drv_data->nirq_work);
+	return IRQ_HANDLED;
+}
+
+/* far, the chip is polled once per doze period of the default 8 scans */
+#define SX9324_POLL_FAR_SCANS	8
+
+static enum hrtimer_restart sx9324_poll_timer(struct hrtimer *timer)
+{
+	struct sx9324_data *drv_data = container_of(timer, struct sx9324_data,
+		poll_timer);
+
+	kthread_queue_work(drv_data->worker, &drv_data->poll_work);
+	/* a period grid, independent of how long sampling takes */
+	hrtimer_forward_now(timer,
+		ms_to_ktime(READ_ONCE(drv_data->poll_interval_ms)));
+	return HRTIMER_RESTART;
+}
+
+/*
+ * One scan period while any phase is near, to bound the latency of the far
+ * transition, and SX9324_POLL_FAR_SCANS scan periods while all are far. A
+ * storm is not polled faster than the storm rate it was detected at.
+ */
+static unsigned int sx9324_poll_interval(struct sx9324_data *drv_data,
+	bool near)
+{
+	unsigned int scan_ms = max(drv_data->scan_period_ms, 1U);
+	unsigned int interval_ms = near ? scan_ms : scan_ms * SX9324_POLL_FAR_SCANS;
+
+	if (drv_data->storm)
+		interval_ms = max_t(unsigned int, interval_ms,
+			DIV_ROUND_UP(MSEC_PER_SEC,
+			max(READ_ONCE(drv_data->storm_rate), 1U)));
+
+	return interval_ms;
+}
+
+/* sample as the NIRQ worker does, then pick the next interval */
+static void sx9324_poll_worker(struct kthread_work *work)
+{
+	struct sx9324_data *drv_data = container_of(work, struct sx9324_data,
+		poll_work);
+
+	sx9324_sample_prox(drv_data, 0);
+	WRITE_ONCE(drv_data->poll_interval_ms,
+		sx9324_poll_interval(drv_data, drv_data->prox_state));
+}
+
+static void sx9324_start_polling(struct sx9324_data *drv_data)
+{
+	WRITE_ONCE(drv_data->poll_interval_ms,
+		sx9324_poll_interval(drv_data, true));
+	hrtimer_start(&drv_data->poll_timer,
+		ms_to_ktime(drv_data->poll_interval_ms), HRTIMER_MODE_REL);
+}
+
+static void sx9324_stop_polling(struct sx9324_data *drv_data)
+{
+	hrtimer_cancel(&drv_data->poll_timer);
+	kthread_cancel_work_sync(&drv_data->poll_work);
+}
+
+/*
+ * NIRQ is disabled: keep only CLOSEANY/FARANY on the pin and poll the chip
+ * for at least a hold period, doubled while storms keep coming back.
+ */
+static void sx9324_storm_worker(struct kthread_work *work)
+{
+	struct sx9324_data *drv_data = container_of(work, struct sx9324_data,
+		storm_work);
+	ktime_t now = ktime_get();
+	int error;
+
+	if (drv_data->storms &&
+		ktime_ms_delta(now, drv_data->storm_end) < drv_data->storm_hold_ms)
+		drv_data->storm_hold_ms = min(drv_data->storm_hold_ms * 2,
+			(unsigned int)SX9324_STORM_HOLD_MAX_MS);
+	else
+		drv_data->storm_hold_ms = SX9324_STORM_HOLD_MS;
+	drv_data->storms++;
+
+	pr_warn("NIRQ storm over %u per second, polling for %u ms\n",
+		drv_data->storm_rate, drv_data->storm_hold_ms);
+
+	error = sx9324_irq_update(drv_data);
+	if (error)
+		pr_err("failed to mask interrupt sources, err=%d\n", error);
+
+	drv_data->storm_polls = 0;
+	drv_data->storm_events = 0;
+	sx9324_start_polling(drv_data);
+	kthread_queue_delayed_work(drv_data->worker, &drv_data->storm_end_work,
+		msecs_to_jiffies(drv_data->storm_hold_ms));
+}
+
+static void sx9324_end_storm(struct sx9324_data *drv_data)
+{
+	int error;
+
+	if (!drv_data->storm)
+		return;
+
+	sx9324_stop_polling(drv_data);
+	WRITE_ONCE(drv_data->storm, false);
+	/* sources demanded meanwhile are enabled now */
+	error = sx9324_irq_update(drv_data);
+	if (error)
+		pr_err("failed to restore interrupt sources, err=%d\n", error);
+
+	drv_data->storm_end = ktime_get();
+	drv_data->irq_window = drv_data->storm_end;
+	drv_data->irq_count = 0;
+	enable_irq(drv_data->nirq);
+	pr_info("NIRQ storm over, back to interrupts\n");
+}
+
+/*
+ * At the end of a hold the storm is over unless CLOSEANY/FARANY still
+ * showed up on most polls of it, then polling is held on for longer.
+ */
+static void sx9324_storm_end_worker(struct kthread_work *work)
+{
+	struct sx9324_data *drv_data = container_of(work, struct sx9324_data,
+		storm_end_work.work);
+
+	if (drv_data->storm && drv_data->storm_events * 2 > drv_data->storm_polls) {
+		drv_data->storm_hold_ms = min(drv_data->storm_hold_ms * 2,
+			(unsigned int)SX9324_STORM_HOLD_MAX_MS);
+		pr_debug("NIRQ storm ongoing, %u of %u polls active, polling for %u ms\n",
+			drv_data->storm_events, drv_data->storm_polls,
+			drv_data->storm_hold_ms);
+		drv_data->storm_polls = 0;
+		drv_data->storm_events = 0;
+		kthread_queue_delayed_work(drv_data->worker,
+			&drv_data->storm_end_work,
+			msecs_to_jiffies(drv_data->storm_hold_ms));
+		return;
+	}
+
+	sx9324_end_storm(drv_data);
+}
+
+/*
+ * Stop servicing the chip before it is powered off and the worker goes.
+ * NIRQ goes first, as it queues the NIRQ and storm work, then the work,
+ * as storm work starts polling and filter work re-arms itself.
+ */
+static void sx9324_stop_service(struct sx9324_data *drv_data)
+{
+	/* nested, a storm ending meanwhile leaves it disabled */
+	if (drv_data->nirq > 0)
+		disable_irq(drv_data->nirq);
+	kthread_cancel_work_sync(&drv_data->nirq_work);
+	kthread_flush_work(&drv_data->storm_work);
+	kthread_cancel_delayed_work_sync(&drv_data->storm_end_work);
+	sx9324_stop_polling(drv_data);
+	kthread_cancel_delayed_work_sync(&drv_data->filter_work);
+	kthread_cancel_work_sync(&drv_data->bus_work);
+}
+
+struct sx9324_sample_reader {
+	struct sx9324_stream *stream;
+	u64 pos;
+};
+
+static void sx9324_stream_free(struct kref *ref)
+{
+	kvfree(container_of(ref, struct sx9324_stream, ref));
+}
+
+/* the reference of the chip, dropped once it is unbound */
+static void sx9324_stream_put(void *data)
+{
+	struct sx9324_stream *stream = data;
+
+	kref_put(&stream->ref, sx9324_stream_free);
+}
+
+/* readers blocked in read() or poll() are woken up to a hangup */
+static void sx9324_stream_detach(struct sx9324_stream *stream)
+{
+	down_write(&stream->chip_lock);
+	stream->drv_data = NULL;
+	up_write(&stream->chip_lock);
+
+	wake_up_interruptible_all(&stream->samples_wait);
+}
+
+static bool sx9324_stream_detached(struct sx9324_stream *stream)
+{
+	return !READ_ONCE(stream->drv_data);
+}
+
+static int sx9324_chip_open(struct inode *inode, struct file *file)
+{
+	struct sx9324_data *drv_data = container_of(file->private_data,
+		struct sx9324_data, misc);
+	struct sx9324_stream *stream = drv_data->stream;
+	struct sx9324_sample_reader *reader;
+	unsigned long flags;
+	int error;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	/* a sample per conversion while the stream is read */
+	if (file->f_mode & FMODE_READ) {
+		error = sx9324_convdone_demand(drv_data, true);
+		if (error) {
+			kfree(reader);
+			return error;
+		}
+	}
+
+	/* only the samples acquired from now on are read */
+	kref_get(&stream->ref);
+	reader->stream = stream;
+	spin_lock_irqsave(&stream->samples_lock, flags);
+	reader->pos = stream->samples_head;
+	spin_unlock_irqrestore(&stream->samples_lock, flags);
+
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int sx9324_chip_release(struct inode *inode, struct file *file)
+{
+	struct sx9324_sample_reader *reader = file->private_data;
+	struct sx9324_stream *stream = reader->stream;
+
+	if (file->f_mode & FMODE_READ) {
+		down_read(&stream->chip_lock);
+		if (stream->drv_data)
+			sx9324_convdone_demand(stream->drv_data, false);
+		up_read(&stream->chip_lock);
+	}
+	sx9324_stream_put(stream);
+	kfree(reader);
+	return 0;
+}
+
+static bool sx9324_sample_available(struct sx9324_sample_reader *reader)
+{
+	return READ_ONCE(reader->stream->samples_head) != reader->pos;
+}
+
+/* read as many whole struct sx9324_sample records as available and fit */
+static ssize_t sx9324_chip_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sx9324_sample_reader *reader = file->private_data;
+	struct sx9324_stream *stream = reader->stream;
+	struct sx9324_sample sample;
+	unsigned long flags;
+	size_t copied = 0;
+	int error;
+
+	if (count < sizeof(sample))
+		return -EINVAL;
+
+	if (!sx9324_sample_available(reader)) {
+		/* end of file once the chip is gone and the samples are read */
+		if (sx9324_stream_detached(stream))
+			return 0;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		error = wait_event_interruptible(stream->samples_wait,
+			sx9324_sample_available(reader) ||
+			sx9324_stream_detached(stream));
+		if (error)
+			return error;
+	}
+
+	while (count - copied >= sizeof(sample)) {
+		spin_lock_irqsave(&stream->samples_lock, flags);
+		if (reader->pos == stream->samples_head) {
+			spin_unlock_irqrestore(&stream->samples_lock, flags);
+			break;
+		}
+		/* a reader left behind skips the overwritten samples */
+		if (stream->samples_head - reader->pos > SX9324_SAMPLES)
+			reader->pos = stream->samples_head - SX9324_SAMPLES;
+		sample = stream->samples[reader->pos % SX9324_SAMPLES];
+		reader->pos++;
+		spin_unlock_irqrestore(&stream->samples_lock, flags);
+
+		if (copy_to_user(buf + copied, &sample, sizeof(sample)))
+			return copied ? copied : -EFAULT;
+		copied += sizeof(sample);
+	}
+
+	return copied;
+}
+
+static unsigned int sx9324_chip_poll(struct file *file, poll_table *wait)
+{
+	struct sx9324_sample_reader *reader = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &reader->stream->samples_wait, wait);
+	if (sx9324_sample_available(reader))
+		mask |= POLLIN | POLLRDNORM;
+	if (sx9324_stream_detached(reader->stream))
+		mask |= POLLHUP;
+
+	return mask;
+}
+
+/*
+ * Run a run of operations of the same direction on adjacent registers as
+ * one bulk access, read values are stored back into the operations. Reads
+ * go to the chip past the register cache, which is not what is debugged,
+ * writes go through regmap to keep the cache up to date.
+ */
+static int sx9324_reg_run(struct sx9324_data *drv_data,
+	struct sx9324_reg_op *ops, int n)
+{
+	struct device *dev = &drv_data->client->dev;
+	u8 buf[U8_MAX + 1];
+	u8 reg = ops[0].reg;
+	int error = 0;
+	int i;
+
+	if (ops[0].flags & SX9324_REG_WRITE) {
+		for (i = 0; i < n; i++)
+			buf[i] = ops[i].val;
+		error = regmap_bulk_write(drv_data->regmap, reg, buf, n);
+	} else {
+		for (i = 0; i < n && !error; i++) {
+			if (!sx9324_readable_reg(dev, reg + i))
+				error = -EINVAL;
+		}
+		if (!error)
+			error = sx9324_regmap_read(drv_data, &reg, sizeof(reg), buf, n);
+		for (i = 0; i < n && !error; i++)
+			ops[i].val = buf[i];
+	}
+
+	for (i = 0; i < n; i++)
+		ops[i].result = error;
+	return error;
+}
+
+/*
+ * Execute a vector of register operations under phdata_lock, so paged
+ * accesses through PHASE_SEL are not interleaved with sampling. Adjacent
+ * registers accessed in the same direction are merged into bulk transfers.
+ * The batch stops at the first failed run, the operations of which are
+ * counted in done with their error.
+ */
+static int sx9324_reg_ops(struct sx9324_data *drv_data,
+	struct sx9324_reg_op *ops, u32 count, u32 *done)
+{
+	struct device *dev = &drv_data->client->dev;
+	struct sx9324_io_mark mark;
+	bool scan_period = false;
+	int error = 0;
+	u32 i, j, n;
+
+	sx9324_io_begin(drv_data, &mark);
+	mutex_lock(&drv_data->phdata_lock);
+	for (i = 0; i < count && !error; i += n) {
+		for (n = 1; i + n < count; n++) {
+			if (ops[i + n].flags != ops[i].flags ||
+				ops[i + n].reg != ops[i].reg + n)
+				break;
+		}
+
+		error = sx9324_reg_run(drv_data, &ops[i], n);
+		if (error || !(ops[i].flags & SX9324_REG_WRITE))
+			continue;
+
+		/* as for the registers attribute */
+		for (j = i; j < i + n; j++) {
+			if (ops[j].reg == SX9324_GNRL_CTRL_0)
+				scan_period = true;
+			if (ops[j].reg == SX9324_OFFSET_MSB ||
+				ops[j].reg == SX9324_OFFSET_LSB)
+				sx9324_save_offset_locked(drv_data, ops[j].reg, ops[j].val);
+		}
+	}
+	mutex_unlock(&drv_data->phdata_lock);
+	sx9324_io_end(drv_data, SX9324_OP_REG_BATCH, &mark);
+
+	if (scan_period)
+		sx9324_update_scan_period(dev);
+
+	*done = i;
+	return error;
+}
+
+static long sx9324_reg_batch(struct sx9324_data *drv_data, struct file *file,
+	struct sx9324_reg_batch __user *ubatch)
+{
+	struct sx9324_reg_batch batch;
+	struct sx9324_reg_op *ops;
+	int error = 0;
+	u32 i;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.count || batch.count > SX9324_REG_BATCH_MAX)
+		return -EINVAL;
+
+	ops = memdup_user(u64_to_user_ptr(batch.ops),
+		batch.count * sizeof(*ops));
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	for (i = 0; i < batch.count; i++) {
+		if (ops[i].flags & ~SX9324_REG_WRITE) {
+			error = -EINVAL;
+			goto exit;
+		}
+		if ((ops[i].flags & SX9324_REG_WRITE) &&
+			!(file->f_mode & FMODE_WRITE)) {
+			error = -EBADF;
+			goto exit;
+		}
+		ops[i].result = 0;
+	}
+
+	error = sx9324_reg_ops(drv_data, ops, batch.count, &batch.done);
+
+	if (copy_to_user(u64_to_user_ptr(batch.ops), ops,
+		batch.count * sizeof(*ops)) ||
+		copy_to_user(ubatch, &batch, sizeof(batch)))
+		error = -EFAULT;
+
+exit:
+	kfree(ops);
+	return error;
+}
+
+static long sx9324_chip_ioctl(struct file *file, unsigned int cmd,
+	unsigned long arg)
+{
+	struct sx9324_sample_reader *reader = file->private_data;
+	struct sx9324_stream *stream = reader->stream;
+	long ret;
+
+	/* the chip is not unbound while its registers are accessed */
+	down_read(&stream->chip_lock);
+	if (!stream->drv_data) {
+		up_read(&stream->chip_lock);
+		return -ENODEV;
+	}
+
+	switch (cmd) {
+		case SX9324_IOC_REG_BATCH:
+			ret = sx9324_reg_batch(stream->drv_data, file,
+				(struct sx9324_reg_batch __user *)arg);
+			break;
+		default:
+			ret = -ENOTTY;
+			break;
+	}
+	up_read(&stream->chip_lock);
+
+	return ret;
+}
+
+static const struct file_operations sx9324_chip_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_chip_open,
+	.release = sx9324_chip_release,
+	.read = sx9324_chip_read,
+	.poll = sx9324_chip_poll,
+	.unlocked_ioctl = sx9324_chip_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = no_llseek,
+};
+
+static int sx9324_enable_trace(struct sx9324_data *drv_data, bool enable)
+{
+	struct sx9324_trace_record *trace = NULL;
+	unsigned long flags;
+
+	mutex_lock(&drv_data->trace_lock);
+	if (enable && !drv_data->trace) {
+		trace = vmalloc(SX9324_TRACE_RECORDS * sizeof(*trace));
+		if (!trace) {
+			mutex_unlock(&drv_data->trace_lock);
+			return -ENOMEM;
+		}
+	}
+
+	spin_lock_irqsave(&drv_data->io_lock, flags);
+	if (enable) {
+		if (trace) {
+			drv_data->trace_head = 0;
+			drv_data->trace_tail = 0;
+			drv_data->trace_dropped = 0;
+			drv_data->trace_start = ktime_get();
+			drv_data->trace = trace;
+			trace = NULL;
+		}
+	} else {
+		trace = drv_data->trace;
+		drv_data->trace = NULL;
+	}
+	spin_unlock_irqrestore(&drv_data->io_lock, flags);
+	mutex_unlock(&drv_data->trace_lock);
+
+	vfree(trace);
+	return 0;
+}
+
+/* drain the captured records */
+static ssize_t sx9324_trace_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sx9324_data *drv_data = file->private_data;
+	struct sx9324_trace_record recs[32];
+	unsigned long flags;
+	size_t copied = 0;
+	unsigned int n, i;
+
+	mutex_lock(&drv_data->trace_lock);
+	while (drv_data->trace && count - copied >= sizeof(recs[0])) {
+		spin_lock_irqsave(&drv_data->io_lock, flags);
+		n = min_t(unsigned int, drv_data->trace_head - drv_data->trace_tail,
+			min_t(size_t, ARRAY_SIZE(recs), (count - copied) / sizeof(recs[0])));
+		for (i = 0; i < n; i++)
+			recs[i] = drv_data->trace[drv_data->trace_tail++ %
+				SX9324_TRACE_RECORDS];
+		spin_unlock_irqrestore(&drv_data->io_lock, flags);
+
+		if (!n)
+			break;
+		if (copy_to_user(buf + copied, recs, n * sizeof(recs[0]))) {
+			mutex_unlock(&drv_data->trace_lock);
+			return -EFAULT;
+		}
+		copied += n * sizeof(recs[0]);
+	}
+	mutex_unlock(&drv_data->trace_lock);
+
+	return copied;
+}
+
+/* "1" starts a new capture, "0" stops it and drops the records */
+static ssize_t sx9324_trace_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sx9324_data *drv_data = file->private_data;
+	bool enable;
+	int error;
+
+	error = kstrtobool_from_user(buf, count, &enable);
+	if (error)
+		return error;
+
+	if (enable)
+		sx9324_enable_trace(drv_data, false);
+	error = sx9324_enable_trace(drv_data, enable);
+
+	return error ? error : count;
+}
+
+static const struct file_operations sx9324_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = sx9324_trace_read,
+	.write = sx9324_trace_write,
+	.llseek = no_llseek,
+};
+
+#define SX9324_REPLAY_OUTPUT_SIZE (256 * 1024)
+
+/*
+ * Replay of a capture through the prox filter, with the filter settings in
+ * use when the file was opened. The captured IRQ_SRC/STAT_0 burst reads
+ * are fed as samples at their captured time, together with the proxdiff
+ * read after them through PHASE_SEL, so hysteresis applies as it did live.
+ * A sample is decided at the next one, the last when the output is read.
+ * The resulting decisions are read back as text.
+ */
+struct sx9324_replay {
+	struct sx9324_data *drv_data;
+	struct sx9324_filter_cfg cfg;
+	struct sx9324_prox_filter filter[SX9324_PHASES];
+	u8 prox;
+	struct sx9324_trace_record prev;
+	u64 time_us;
+	u64 samples;
+	/* the sample waiting for its proxdiff reads */
+	bool pending;
+	u8 raw;
+	u64 sample_time_us;
+	u8 phase_sel;
+	u8 diff_msb;
+	int diff[SX9324_PHASES];
+	u8 diff_mask;
+	/* far samples hysteresis could not be applied to */
+	u64 diff_missing;
+	char *out;
+	size_t out_len;
+	size_t out_pos;
+	u64 out_dropped;
+};
+
+static int sx9324_replay_open(struct inode *inode, struct file *file)
+{
+	struct sx9324_data *drv_data = inode->i_private;
+	struct sx9324_replay *replay;
+
+	replay = kzalloc(sizeof(*replay), GFP_KERNEL);
+	if (!replay)
+		return -ENOMEM;
+
+	replay->out = vmalloc(SX9324_REPLAY_OUTPUT_SIZE);
+	if (!replay->out) {
+		kfree(replay);
+		return -ENOMEM;
+	}
+
+	replay->drv_data = drv_data;
+	replay->cfg = drv_data->filter_cfg;
+	file->private_data = replay;
+
+	return nonseekable_open(inode, file);
+}
+
+static int sx9324_replay_release(struct inode *inode, struct file *file)
+{
+	struct sx9324_replay *replay = file->private_data;
+
+	if (replay->out_dropped)
+		pr_warn("replay output overflowed, %llu decisions dropped\n",
+			replay->out_dropped);
+	if (replay->diff_missing)
+		pr_warn("replay lacks proxdiff on %llu far samples, hysteresis not applied\n",
+			replay->diff_missing);
+	vfree(replay->out);
+	kfree(replay);
+	return 0;
+}
+
+static void sx9324_replay_sample(struct sx9324_replay *replay)
+{
+	unsigned int retry_ms;
+	u8 prox, changed;
+	int i;
+
+	if (!replay->pending)
+		return;
+	replay->pending = false;
+
+	if (replay->cfg.hysteresis) {
+		for (i = PH0; i < SX9324_PHASES; i++) {
+			if (replay->filter[i].close &&
+				!((replay->raw >> i) & 0x01) &&
+				!((replay->diff_mask >> i) & 0x01))
+				replay->diff_missing++;
+		}
+	}
+
+	/* time 0 means no decision yet to the filter */
+	prox = sx9324_filter_prox(&replay->cfg, replay->filter, replay->raw,
+		replay->diff, replay->diff_mask, 0,
+		us_to_ktime(replay->sample_time_us + 1),
+		replay->drv_data->scan_period_ms, &retry_ms);
+	changed = prox ^ replay->prox;
+	replay->prox = prox;
+	replay->samples++;
+
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if (!((changed >> i) & 0x01))
+			continue;
+		if (SX9324_REPLAY_OUTPUT_SIZE - replay->out_len < 64) {
+			replay->out_dropped++;
+			continue;
+		}
+		replay->out_len += scnprintf(replay->out + replay->out_len,
+			SX9324_REPLAY_OUTPUT_SIZE - replay->out_len,
+			"time_us=%llu phase=%d %s\n", replay->sample_time_us, i,
+			(prox >> i) & 0x01 ? "close" : "far");
+	}
+}
+
+static void sx9324_replay_record(struct sx9324_replay *replay,
+	const struct sx9324_trace_record *rec)
+{
+	/* capture time wraps around, records are in order */
+	replay->time_us += (u32)(rec->time_us - replay->prev.time_us);
+	if (rec->flags == SX9324_TRACE_READ &&
+		rec->reg == SX9324_STAT_0 &&
+		replay->prev.flags == SX9324_TRACE_READ &&
+		replay->prev.reg == SX9324_IRQ_SRC &&
+		replay->prev.time_us == rec->time_us) {
+		sx9324_replay_sample(replay);
+		replay->pending = true;
+		replay->raw = rec->val & SX9324_PROXSTAT;
+		replay->sample_time_us = replay->time_us;
+		replay->diff_mask = 0;
+	} else if (rec->flags == SX9324_TRACE_WRITE &&
+		rec->reg == SX9324_PHASE_SEL) {
+		replay->phase_sel = rec->val;
+	} else if (rec->flags == SX9324_TRACE_READ &&
+		rec->reg == SX9324_DIFF_MSB) {
+		replay->diff_msb = rec->val;
+	} else if (rec->flags == SX9324_TRACE_READ &&
+		rec->reg == SX9324_DIFF_LSB &&
+		replay->prev.reg == SX9324_DIFF_MSB &&
+		replay->phase_sel < SX9324_PHASES) {
+		/* as read by sx9324_read_proxdiff() */
+		replay->diff[replay->phase_sel] =
+			(short)((replay->diff_msb << 8) | rec->val);
+		replay->diff_mask |= BIT(replay->phase_sel);
+	}
+	replay->prev = *rec;
+}
+
+static ssize_t sx9324_replay_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sx9324_replay *replay = file->private_data;
+	struct sx9324_trace_record recs[32];
+	size_t consumed = 0;
+	size_t n, i;
+
+	while (count - consumed >= sizeof(recs[0])) {
+		n = min_t(size_t, ARRAY_SIZE(recs),
+			(count - consumed) / sizeof(recs[0]));
+		if (copy_from_user(recs, buf + consumed, n * sizeof(recs[0])))
+			return -EFAULT;
+
+		for (i = 0; i < n; i++)
+			sx9324_replay_record(replay, &recs[i]);
+		consumed += n * sizeof(recs[0]);
+	}
+
+	return consumed;
+}
+
+static ssize_t sx9324_replay_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sx9324_replay *replay = file->private_data;
+	size_t n;
+
+	sx9324_replay_sample(replay);
+	n = min(count, replay->out_len - replay->out_pos);
+
+	if (copy_to_user(buf, replay->out + replay->out_pos, n))
+		return -EFAULT;
+
+	replay->out_pos += n;
+	if (replay->out_pos == replay->out_len)
+		replay->out_pos = replay->out_len = 0;
+
+	return n;
+}
+
+static const struct file_operations sx9324_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_replay_open,
+	.release = sx9324_replay_release,
+	.read = sx9324_replay_read,
+	.write = sx9324_replay_write,
+	.llseek = no_llseek,
+};
+
+static int sx9324_recovery_show(struct seq_file *s, void *unused)
+{
+	struct sx9324_data *drv_data = s->private;
+
+	mutex_lock(&drv_data->phdata_lock);
+	seq_printf(s, "recoveries %u\n", drv_data->recoveries);
+	seq_printf(s, "failures %u\n", drv_data->recovery_failures);
+	seq_printf(s, "last_us %lld\n", drv_data->recovery_last_us);
+	seq_printf(s, "max_us %lld\n", drv_data->recovery_max_us);
+	seq_printf(s, "saved_offsets 0x%02x\n", drv_data->saved_offset_valid);
+	mutex_unlock(&drv_data->phdata_lock);
+
+	return 0;
+}
+
+static int sx9324_recovery_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sx9324_recovery_show, inode->i_private);
+}
+
+static const struct file_operations sx9324_recovery_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_recovery_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* a 1/256 fixed point value with two decimals */
+static void sx9324_seq_fixed(struct seq_file *s, const char *name, s64 val)
+{
+	u64 abs = val < 0 ? -val : val;
+
+	seq_printf(s, " %s %s%llu.%02llu", name, val < 0 ? "-" : "",
+		abs >> SX9324_STATS_FRAC,
+		((abs & (BIT(SX9324_STATS_FRAC) - 1)) * 100) >> SX9324_STATS_FRAC);
+}
+
+static void sx9324_seq_stats(struct seq_file *s, int phase, const char *name,
+	const struct sx9324_running_stats *stats)
+{
+	u64 n = stats->count;
+	u64 abs = stats->sum < 0 ? -stats->sum : stats->sum;
+	u64 var = 0;
+
+	/* (sumsq - sum^2 / n) / (n - 1), both terms floored alike */
+	if (n > 1)
+		var = mul_u64_u64_div_u64(stats->sumsq, BIT(SX9324_STATS_FRAC),
+			n - 1) - mul_u64_u64_div_u64(abs << SX9324_STATS_FRAC, abs,
+			n * (n - 1));
+
+	seq_printf(s, "phase%d %s", phase, name);
+	sx9324_seq_fixed(s, "mean",
+		div64_s64(stats->sum * (1 << SX9324_STATS_FRAC), n));
+	sx9324_seq_fixed(s, "var", var);
+	seq_printf(s, " min %d max %d p2p %d\n", stats->min, stats->max,
+		stats->max - stats->min);
+}
+
+static int sx9324_noise_show(struct seq_file *s, void *unused)
+{
+	struct sx9324_data *drv_data = s->private;
+	struct sx9324_noise *noise;
+	unsigned long flags;
+	int width;
+	int i, j;
+
+	noise = kmalloc_array(SX9324_PHASES, sizeof(*noise), GFP_KERNEL);
+	if (!noise)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&drv_data->noise_lock, flags);
+	memcpy(noise, drv_data->noise, sizeof(drv_data->noise));
+	width = drv_data->noise_bin_width;
+	spin_unlock_irqrestore(&drv_data->noise_lock, flags);
+
+	for (i = PH0; i < SX9324_PHASES; i++) {
+		if (!noise[i].useful.count)
+			continue;
+		seq_printf(s, "phase%d samples %llu\n", i, noise[i].useful.count);
+		sx9324_seq_stats(s, i, "useful", &noise[i].useful);
+		sx9324_seq_stats(s, i, "diff", &noise[i].diff);
+		seq_printf(s, "phase%d diff_hist from %d width %d:", i,
+			-SX9324_HIST_BINS / 2 * width, width);
+		for (j = 0; j < SX9324_HIST_BINS; j++)
+			seq_printf(s, " %u", noise[i].hist[j]);
+		seq_puts(s, "\n");
 	}
 
+	kfree(noise);
+	return 0;
+}
+
+static int sx9324_noise_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sx9324_noise_show, inode->i_private);
+}
+
+/* any write clears the statistics, noise_bin_width applies from then on */
+static ssize_t sx9324_noise_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct sx9324_data *drv_data =
+		((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&drv_data->noise_lock, flags);
+	memset(drv_data->noise, 0, sizeof(drv_data->noise));
+	drv_data->noise_bin_width = READ_ONCE(drv_data->noise_bin_width_next);
+	spin_unlock_irqrestore(&drv_data->noise_lock, flags);
+
 	return count;
 }
 
-static ssize_t sx9324_reset_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+static const struct file_operations sx9324_noise_fops = {
+	.owner = THIS_MODULE,
+	.open = sx9324_noise_open,
+	.read = seq_read,
+	.write = sx9324_noise_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int sx9324_noise_bin_width_get(void *data, u64 *val)
 {
-	sx9324_reset(dev, SOFTWARE_RESET);
+	struct sx9324_data *drv_data = data;
+
+	*val = READ_ONCE(drv_data->noise_bin_width_next);
 	return 0;
 }
 
-static ssize_t sx9324_phdata_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+static int sx9324_noise_bin_width_set(void *data, u64 val)
+{
+	struct sx9324_data *drv_data = data;
+
+	if (!val || val > SX9324_NOISE_BIN_WIDTH_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(drv_data->noise_bin_width_next, val);
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(sx9324_noise_bin_width_fops,
+	sx9324_noise_bin_width_get, sx9324_noise_bin_width_set, "%llu\n");
+
+static void sx9324_create_debugfs(struct device *dev)
 {
 	struct sx9324_data *drv_data =
 		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
-	struct sx9324_phase_data phdata[SX9324_PHASES];
-	int written = 0;
-	int i;
-	int error;
+	char name[32];
 
-	written += sprintf(buf + written, "PH Useful Avg Diff Steady Prox Table Body Fail Comp\n");
-	written += sprintf(buf + written, "===================================================\n");
-	error = sx9324_read_phdata(dev, phdata);
-	if (!error) {
-		for (i = PH0; i < SX9324_PHASES; i++) {
-			if (phdata[i].is_valid) {
-				written += sprintf(buf + written, "%d %d %d %d %d %d %d %d %d %d\n", i,
-					phdata[i].proxuseful, phdata[i].proxavg, phdata[i].proxdiff,
-					phdata[i].stat.steady, phdata[i].stat.prox, phdata[i].stat.table,
-					phdata[i].stat.body, phdata[i].stat.fail, phdata[i].stat.comp);
-			}
-		}
+	snprintf(name, sizeof(name), DRIVER_NAME "-%s", dev_name(dev));
+	drv_data->debugfs = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(drv_data->debugfs)) {
+		pr_debug("debugfs is not available\n");
+		drv_data->debugfs = NULL;
+		return;
 	}
-	return written;
+
+	debugfs_create_file("io_stats", S_IWUSR | S_IRUGO, drv_data->debugfs,
+		drv_data, &sx9324_io_stats_fops);
+	debugfs_create_file("io_profile", S_IWUSR | S_IRUGO, drv_data->debugfs,
+		drv_data, &sx9324_io_profile_fops);
+	debugfs_create_u32("model_xfer_ns", S_IWUSR | S_IRUGO, drv_data->debugfs,
+		&drv_data->model_xfer_ns);
+	debugfs_create_u32("model_byte_ns", S_IWUSR | S_IRUGO, drv_data->debugfs,
+		&drv_data->model_byte_ns);
+	debugfs_create_file("latency", S_IWUSR | S_IRUGO, drv_data->debugfs,
+		drv_data, &sx9324_latency_fops);
+	debugfs_create_file("trace", S_IWUSR | S_IRUSR, drv_data->debugfs,
+		drv_data, &sx9324_trace_fops);
+	debugfs_create_file("replay", S_IWUSR | S_IRUSR, drv_data->debugfs,
+		drv_data, &sx9324_replay_fops);
+	debugfs_create_file("recovery", S_IRUGO, drv_data->debugfs,
+		drv_data, &sx9324_recovery_fops);
+	debugfs_create_u32("irq_storms", S_IRUGO, drv_data->debugfs,
+		&drv_data->storms);
+	debugfs_create_file("noise", S_IWUSR | S_IRUGO, drv_data->debugfs,
+		drv_data, &sx9324_noise_fops);
+	debugfs_create_file_unsafe("noise_bin_width", S_IWUSR | S_IRUGO,
+		drv_data->debugfs, drv_data, &sx9324_noise_bin_width_fops);
 }
 
-static ssize_t sx9324_mode_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+/*
+ * Build the software defaults of the chip: sx9324_reg_defaults with the
+ * <reg value> pairs of "semtech,reg-init" overriding or adding registers,
+ * the last pair of a register winning. The pairs are also kept as written
+ * for sx9324_reset_software_default().
+ */
+static int sx9324_load_reg_defaults(struct device *dev)
 {
 	struct sx9324_data *drv_data =
 		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
-	enum sx9324_operational_mode mode;
-	int written = 0;
+	struct reg_default *defaults;
+	struct reg_default *init = NULL;
+	u8 *pairs = NULL;
+	int npairs = 0;
+	int num = ARRAY_SIZE(sx9324_reg_defaults);
 	int error;
+	int i, j;
 
-	error = sx9324_get_mode(dev, &mode);
-	if (!error) {
-		written += sprintf(buf + written, "%c active\n",
-			mode == SX9324_ACTIVE ? 'v' : ' ');
-		written += sprintf(buf + written, "%c doze\n",
-			mode == SX9324_DOZE ? 'v' : ' ');
-		written += sprintf(buf + written, "%c sleep\n",
-			mode == SX9324_SLEEP ? 'v' : ' ');
-	} else {
-		*buf = '\0';
+	error = of_property_count_u8_elems(dev->of_node, "semtech,reg-init");
+	if (error > 0) {
+		if (error % 2) {
+			pr_err("semtech,reg-init must be <reg value> pairs\n");
+			return -EINVAL;
+		}
+		npairs = error / 2;
+		pairs = kmalloc(npairs * 2, GFP_KERNEL);
+		if (!pairs)
+			return -ENOMEM;
+		error = of_property_read_u8_array(dev->of_node, "semtech,reg-init",
+			pairs, npairs * 2);
+		if (error) {
+			kfree(pairs);
+			return error;
+		}
 	}
 
-	return written;
-}
+	defaults = devm_kcalloc(dev, num + npairs, sizeof(*defaults), GFP_KERNEL);
+	if (!defaults) {
+		kfree(pairs);
+		return -ENOMEM;
+	}
+	memcpy(defaults, sx9324_reg_defaults, sizeof(sx9324_reg_defaults));
+	if (npairs) {
+		init = devm_kcalloc(dev, npairs, sizeof(*init), GFP_KERNEL);
+		if (!init) {
+			kfree(pairs);
+			return -ENOMEM;
+		}
+	}
 
-static ssize_t sx9324_mode_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t count)
-{
-	if (buf && count != 0) {
-		if (0 == strncmp(buf, "active", 6))
-			sx9324_set_mode(dev, SX9324_ACTIVE);
-		else if (0 == strncmp(buf, "doze", 4))
-			sx9324_set_mode(dev, SX9324_DOZE);
-		else if (0 == strncmp(buf, "sleep", 5))
-			sx9324_set_mode(dev, SX9324_SLEEP);
+	for (i = 0; i < npairs; i++) {
+		if (!sx9324_writeable_reg(dev, pairs[2 * i]) ||
+			pairs[2 * i] == SX9324_RESET) {
+			pr_err("register 0x%02x can not be initialized\n", pairs[2 * i]);
+			kfree(pairs);
+			return -EINVAL;
+		}
+		init[i].reg = pairs[2 * i];
+		init[i].def = pairs[2 * i + 1];
+		for (j = 0; j < num; j++) {
+			if (defaults[j].reg == pairs[2 * i])
+				break;
+		}
+		defaults[j].reg = pairs[2 * i];
+		defaults[j].def = pairs[2 * i + 1];
+		if (j == num)
+			num++;
 	}
+	kfree(pairs);
 
-	return count;
+	drv_data->reg_defaults = defaults;
+	drv_data->num_reg_defaults = num;
+	drv_data->reg_init = init;
+	drv_data->num_reg_init = npairs;
+	return 0;
 }
 
-static struct device_attribute sx9324_attrs[] =
-{
-	__ATTR(registers, S_IWUSR | S_IRUGO, sx9324_registers_show,
-		sx9324_registers_store),
-	__ATTR(reset, S_IRUSR, sx9324_reset_show, NULL),
-	__ATTR(phdata, S_IRUGO, sx9324_phdata_show, NULL),
-	__ATTR(mode, S_IWUSR | S_IRUGO, sx9324_mode_show, sx9324_mode_store),
-};
-
-static int sx9324_create_sysfs_attr(struct device *dev)
+/* host side filter tuning, "semtech,prox-filter" = <debounce holdoff hyst> */
+static int sx9324_load_filter_cfg(struct device *dev)
 {
-	int i;
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	u32 cfg[3];
 	int error;
 
-	for (i = 0; i < ARRAY_SIZE(sx9324_attrs); i++) {
-		error = device_create_file(dev, &sx9324_attrs[i]);
-		if (error) {
-			pr_err("failed creating device attribute files, err=%d\n", error);
-			break;
-		}
-	}
+	drv_data->filter_cfg.debounce = 1;
+	if (!of_find_property(dev->of_node, "semtech,prox-filter", NULL))
+		return 0;
 
-	if (i < ARRAY_SIZE(sx9324_attrs)) {
-		for (i--; i >= 0; i--)
-			device_remove_file(dev, &sx9324_attrs[i]);
+	error = of_property_read_u32_array(dev->of_node, "semtech,prox-filter",
+		cfg, ARRAY_SIZE(cfg));
+	if (error || cfg[0] == 0) {
+		pr_err("semtech,prox-filter must be <debounce holdoff_ms hysteresis>\n");
+		return -EINVAL;
 	}
 
-	return error;
+	drv_data->filter_cfg.debounce = cfg[0];
+	drv_data->filter_cfg.holdoff_ms = cfg[1];
+	drv_data->filter_cfg.hysteresis = cfg[2];
+	return 0;
 }
 
-static void sx9324_remove_sysfs_attr(struct device *dev)
+/*
+ * Scheduling of the NIRQ service thread, "semtech,sched-class" as for the
+ * irq_sched attribute, and the CPUs it may run on, "semtech,cpus".
+ */
+static int sx9324_load_sched(struct device *dev)
 {
-	int i;
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	struct device_node *np = dev->of_node;
+	const char *name;
+	u32 cpu;
+	int i, n;
 
-	for (i = 0; i < ARRAY_SIZE(sx9324_attrs); i++)
-		device_remove_file(dev, &sx9324_attrs[i]);
-}
+	if (!of_property_read_string(np, "semtech,sched-class", &name)) {
+		n = match_string(sx9324_sched_class_names,
+			ARRAY_SIZE(sx9324_sched_class_names), name);
+		if (n < 0) {
+			pr_err("semtech,sched-class '%s' is unknown\n", name);
+			return -EINVAL;
+		}
+		sx9324_set_sched(drv_data, n);
+	}
 
-static void sx9324_nirq_worker(struct work_struct *work) {
-	struct sx9324_data *drv_data = container_of(work, struct sx9324_data,
-		nirq_work);
-	unsigned int val;
-	int err;
+	cpumask_copy(&drv_data->worker_cpus, cpu_possible_mask);
 
-	err = regmap_read(drv_data->regmap, SX9324_IRQ_SRC, &val);
-	if (!err) {
-		pr_debug("IRQ SRC: 0x%02x; Reset=%d, Close=%d, Far=%d\n", val,
-			val & SX9324_RESETIRQ ? 1 : 0,
-			val & SX9324_CLOSEANYIRQ ? 1 : 0,
-			val & SX9324_FARANYIRQ ? 1 : 0);
-	} else {
-		pr_err("failed to read register (SX9324_IRQ_SRC), err=%d\n", err);
+	n = of_property_count_u32_elems(np, "semtech,cpus");
+	if (n <= 0)
+		return 0;
+
+	cpumask_clear(&drv_data->worker_cpus);
+	for (i = 0; i < n; i++) {
+		of_property_read_u32_index(np, "semtech,cpus", i, &cpu);
+		if (cpu >= nr_cpu_ids) {
+			pr_err("semtech,cpus lists cpu %u, not on this system\n", cpu);
+			return -EINVAL;
+		}
+		cpumask_set_cpu(cpu, &drv_data->worker_cpus);
 	}
-}
 
-static irqreturn_t sx9324_nirq_handler(int irq, void *p)
-{
-	struct sx9324_data *drv_data =
-		(struct sx9324_data *)i2c_get_clientdata(p);
-	queue_work(drv_data->workqueue, &drv_data->nirq_work);
-	return IRQ_HANDLED;
+	return set_cpus_allowed_ptr(drv_data->worker->task,
+		&drv_data->worker_cpus);
 }
 
 static int sx9324_probe(struct i2c_client *client,
 	const struct i2c_device_id *id)
 {
 	struct sx9324_data *drv_data;
+	struct sx9324_io_mark mark;
+	bool smbus = false;
 	int error;
+	int irq;
 	int i;
 
 	pr_info("probed i2c client '%s', functionality=0x%x\n", client->name,
 		i2c_get_functionality(client->adapter));
 
 	if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C)) {
-		pr_err("no specified i2c functionality\n");
-		return -ENODEV;
+		if (!i2c_check_functionality(client->adapter,
+			I2C_FUNC_SMBUS_I2C_BLOCK)) {
+			pr_err("no specified i2c functionality\n");
+			return -ENODEV;
+		}
+		pr_info("SMBus only adapter, using I2C block commands\n");
+		smbus = true;
 	}
 
 	drv_data = devm_kzalloc(&client->dev, sizeof(*drv_data), GFP_KERNEL);
@@ -761,25 +4179,73 @@ static int sx9324_probe(struct i2c_client *client,
 		pr_err("failed memory allocation\n");
 		return -ENOMEM;
 	}
+	drv_data->smbus = smbus;
+
+	/* outlives drv_data while the chip device is held open */
+	drv_data->stream = kvzalloc(sizeof(*drv_data->stream), GFP_KERNEL);
+	if (!drv_data->stream) {
+		pr_err("failed memory allocation\n");
+		return -ENOMEM;
+	}
+	kref_init(&drv_data->stream->ref);
+	init_rwsem(&drv_data->stream->chip_lock);
+	drv_data->stream->drv_data = drv_data;
+	spin_lock_init(&drv_data->stream->samples_lock);
+	init_waitqueue_head(&drv_data->stream->samples_wait);
+	error = devm_add_action_or_reset(&client->dev, sx9324_stream_put,
+		drv_data->stream);
+	if (error)
+		return error;
 
 	drv_data->client = client;
+	mutex_init(&drv_data->phdata_lock);
+	mutex_init(&drv_data->irq_lock);
+	/* RESETIRQ of the power-up reset is expected */
+	drv_data->resetting = true;
+	spin_lock_init(&drv_data->io_lock);
+	mutex_init(&drv_data->trace_lock);
+	spin_lock_init(&drv_data->noise_lock);
+	drv_data->noise_bin_width = 4;
+	drv_data->noise_bin_width_next = 4;
+	spin_lock_init(&drv_data->latency_lock);
+	drv_data->model_xfer_ns = 30000;
+	seqlock_init(&drv_data->snapshot_lock);
+	mutex_init(&drv_data->acquire_lock);
 	i2c_set_clientdata(client, drv_data);
 
-	drv_data->workqueue = create_singlethread_workqueue("workqueue");
-	if (!drv_data->workqueue) {
-		pr_err("failed to create the workqueue\n");
-		return -ENOMEM;
+	drv_data->worker = kthread_create_worker(0, DRIVER_NAME "-%s",
+		dev_name(&client->dev));
+	if (IS_ERR(drv_data->worker)) {
+		error = PTR_ERR(drv_data->worker);
+		pr_err("failed to create the service thread, err=%d\n", error);
+		return error;
 	}
-	INIT_WORK(&drv_data->nirq_work, sx9324_nirq_worker);
+	error = sx9324_load_sched(&client->dev);
+	if (error) {
+		pr_err("failed to set the service thread scheduling, err=%d\n", error);
+		kthread_destroy_worker(drv_data->worker);
+		return error;
+	}
+	kthread_init_work(&drv_data->nirq_work, sx9324_nirq_worker);
+	kthread_init_work(&drv_data->bus_work, sx9324_bus_worker);
+	kthread_init_work(&drv_data->poll_work, sx9324_poll_worker);
+	kthread_init_work(&drv_data->storm_work, sx9324_storm_worker);
+	kthread_init_delayed_work(&drv_data->storm_end_work,
+		sx9324_storm_end_worker);
+	drv_data->storm_rate = SX9324_STORM_RATE;
+	hrtimer_init(&drv_data->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	drv_data->poll_timer.function = sx9324_poll_timer;
+	kthread_init_delayed_work(&drv_data->filter_work, sx9324_filter_worker);
 
-	drv_data->regmap = devm_regmap_init_i2c(client, &sx9324_regmap_config);
+	drv_data->regmap = devm_regmap_init(&client->dev, &sx9324_regmap_bus,
+		drv_data, &sx9324_regmap_config);
 	if (IS_ERR(drv_data->regmap)) {
 		error = PTR_ERR(drv_data->regmap);
 		pr_err("failed to initialize regmap, err=%d\n", error);
 		goto error_exit;
 	}
 
-	drv_data->nirq_gpio = devm_gpiod_get(&client->dev, "nirq",
+	drv_data->nirq_gpio = devm_gpiod_get_optional(&client->dev, "nirq",
 		GPIOD_IN);
 	if (IS_ERR(drv_data->nirq_gpio)) {
 		error = PTR_ERR(drv_data->nirq_gpio);
@@ -787,21 +4253,29 @@ static int sx9324_probe(struct i2c_client *client,
 		goto error_exit;
 	}
 
-	drv_data->nirq = gpiod_to_irq(drv_data->nirq_gpio);
-	if (drv_data->nirq < 0) {
-		error = drv_data->nirq;
-		pr_err("failed to retrieve irq corresponding to gpio-%d, err=%d\n",
-			desc_to_gpio(drv_data->nirq_gpio), error);
-		goto error_exit;
-	}
+	drv_data->polling = !drv_data->nirq_gpio ||
+		of_property_read_bool(client->dev.of_node, "semtech,polling");
+	if (drv_data->polling) {
+		pr_info("NIRQ is not used, polling the chip\n");
+	} else {
+		irq = gpiod_to_irq(drv_data->nirq_gpio);
+		if (irq < 0) {
+			error = irq;
+			pr_err("failed to retrieve irq corresponding to gpio-%d, err=%d\n",
+				desc_to_gpio(drv_data->nirq_gpio), error);
+			goto error_exit;
+		}
 
-	error = devm_request_any_context_irq(&client->dev, drv_data->nirq,
-		sx9324_nirq_handler, IRQ_TYPE_EDGE_FALLING, dev_name(&client->dev),
-		client);
-	if (error < 0) {
-		pr_err("failed to claim irq for gpio-%d, err=%d\n",
-			desc_to_gpio(drv_data->nirq_gpio), error);
-		goto error_exit;
+		error = devm_request_any_context_irq(&client->dev, irq,
+			sx9324_nirq_handler, IRQ_TYPE_EDGE_FALLING,
+			dev_name(&client->dev), client);
+		if (error < 0) {
+			pr_err("failed to claim irq for gpio-%d, err=%d\n",
+				desc_to_gpio(drv_data->nirq_gpio), error);
+			goto error_exit;
+		}
+		/* only set once claimed, for the teardown to disable it */
+		drv_data->nirq = irq;
 	}
 
 	drv_data->vdd = devm_regulator_get(&client->dev, "vdd");
@@ -821,37 +4295,99 @@ static int sx9324_probe(struct i2c_client *client,
 	error = sx9324_enable_pullup(&client->dev, true);
 	error |= sx9324_enable_vdd(&client->dev, true);
 	if (error) {
-		sx9324_enable_vdd(&client->dev, false);
-		sx9324_enable_pullup(&client->dev, false);
 		pr_err("failed to enable the power supply, err=%d\n", error);
 		goto error_exit;
 	}
 
+	sx9324_io_begin(drv_data, &mark);
 	error = sx9324_reset(&client->dev, POWER_UP_RESET);
 	if (error) {
 		pr_err("failed to reset the chip on power-up, err=%d", error);
 		goto error_exit;
 	}
 
+	error = sx9324_load_reg_defaults(&client->dev);
+	if (error) {
+		pr_err("failed to load semtech,reg-init, err=%d\n", error);
+		goto error_exit;
+	}
+
+	error = sx9324_load_filter_cfg(&client->dev);
+	if (error) {
+		pr_err("failed to load semtech,prox-filter, err=%d\n", error);
+		goto error_exit;
+	}
+
 	error = sx9324_reset_software_default(&client->dev);
 	if (error) {
 		pr_err("failed to reset registers to software default, err=%d\n", error);
 		goto error_exit;
 	}
 
+	error = sx9324_update_scan_period(&client->dev);
+	if (error) {
+		pr_err("failed to read the scan period, err=%d\n", error);
+		goto error_exit;
+	}
+
+	error = sx9324_irq_init(drv_data);
+	if (error) {
+		pr_err("failed to set the interrupt sources up, err=%d\n", error);
+		goto error_exit;
+	}
+	WRITE_ONCE(drv_data->resetting, false);
+	sx9324_io_end(drv_data, SX9324_OP_PROBE, &mark);
+
+	/* waking up the host takes NIRQ */
+	device_init_wakeup(&client->dev, !drv_data->polling &&
+		of_property_read_bool(client->dev.of_node, "wakeup-source"));
+
 	error = sx9324_create_sysfs_attr(&client->dev);
 	if (error) {
 		pr_err("failed to create sysfs device attributes, err=%d\n", error);
 		goto error_exit;
 	}
 
+	error = sx9324_group_join(&client->dev);
+	if (error) {
+		pr_err("failed to join the SAR group, err=%d\n", error);
+		sx9324_remove_sysfs_attr(&client->dev);
+		goto error_exit;
+	}
+
+	snprintf(drv_data->misc_name, sizeof(drv_data->misc_name),
+		DRIVER_NAME "-%s", dev_name(&client->dev));
+	drv_data->misc.minor = MISC_DYNAMIC_MINOR;
+	drv_data->misc.name = drv_data->misc_name;
+	drv_data->misc.fops = &sx9324_chip_fops;
+	drv_data->misc.parent = &client->dev;
+	error = misc_register(&drv_data->misc);
+	if (error) {
+		pr_err("failed to register the chip device, err=%d\n", error);
+		sx9324_group_leave(&client->dev);
+		sx9324_remove_sysfs_attr(&client->dev);
+		goto error_exit;
+	}
+
 	for (i = 0; i < MAX_DUMPING_REGISTERS; i++)
 		dumping_regs[i] = REGISTER_UNSET_VALUE;
 
+	sx9324_create_debugfs(&client->dev);
+
+	mutex_lock(&sx9324_devices_lock);
+	list_add_tail(&drv_data->node, &sx9324_devices);
+	mutex_unlock(&sx9324_devices_lock);
+
+	if (drv_data->polling)
+		sx9324_start_polling(drv_data);
+
 	return 0;
 
 error_exit:
-	destroy_workqueue(drv_data->workqueue);
+	sx9324_stop_service(drv_data);
+	sx9324_enable_vdd(&client->dev, false);
+	sx9324_enable_pullup(&client->dev, false);
+	kthread_destroy_worker(drv_data->worker);
 	return error;
 }
 
@@ -859,21 +4395,105 @@ static int sx9324_remove(struct i2c_client *client)
 {
 	struct sx9324_data *drv_data =
 		(struct sx9324_data *)i2c_get_clientdata(client);
+	mutex_lock(&sx9324_devices_lock);
+	list_del(&drv_data->node);
+	mutex_unlock(&sx9324_devices_lock);
+	misc_deregister(&drv_data->misc);
+	sx9324_stream_detach(drv_data->stream);
+	debugfs_remove_recursive(drv_data->debugfs);
+	sx9324_enable_trace(drv_data, false);
 	sx9324_remove_sysfs_attr(&client->dev);
+	sx9324_stop_service(drv_data);
 	sx9324_enable_vdd(&client->dev, false);
 	sx9324_enable_pullup(&client->dev, false);
-	destroy_workqueue(drv_data->workqueue);
+	kthread_destroy_worker(drv_data->worker);
+	sx9324_group_leave(&client->dev);
 	return 0;
 }
 
+/*
+ * As a wakeup source the chip keeps scanning in doze with only CLOSEANY and
+ * FARANY unmasked, so the host is woken up by SAR transitions only.
+ */
 static int sx9324_suspend(struct device *dev)
 {
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	int error;
+
+	WRITE_ONCE(drv_data->suspended, true);
+	if (drv_data->polling)
+		sx9324_stop_polling(drv_data);
+	/* a storm is over as far as suspend goes, NIRQ may be a wakeup */
+	kthread_flush_work(&drv_data->storm_work);
+	kthread_cancel_delayed_work_sync(&drv_data->storm_end_work);
+	sx9324_end_storm(drv_data);
+	kthread_flush_work(&drv_data->nirq_work);
+	kthread_cancel_delayed_work_sync(&drv_data->filter_work);
+	kthread_flush_work(&drv_data->bus_work);
+
+	if (!device_may_wakeup(dev))
+		return 0;
+
+	error = sx9324_get_mode(dev, &drv_data->saved_mode);
+	if (error) {
+		pr_err("failed to save the chip state, err=%d\n", error);
+		goto error_exit;
+	}
+
+	/* only CLOSEANY/FARANY, whatever else is demanded */
+	drv_data->wake_armed = true;
+	error = sx9324_set_mode(dev, SX9324_DOZE);
+	if (!error)
+		error = sx9324_irq_demand(drv_data, SX9324_IRQ_ESSENTIAL, 0);
+	if (error) {
+		pr_err("failed to set the chip up for wakeup, err=%d\n", error);
+		goto error_restore;
+	}
+
+	error = enable_irq_wake(drv_data->nirq);
+	if (error) {
+		pr_err("failed to enable NIRQ as wakeup, err=%d\n", error);
+		sx9324_irq_demand(drv_data, 0, SX9324_IRQ_ESSENTIAL);
+		goto error_restore;
+	}
+
 	return 0;
+
+error_restore:
+	drv_data->wake_armed = false;
+	sx9324_irq_update(drv_data);
+	sx9324_set_mode(dev, drv_data->saved_mode);
+error_exit:
+	WRITE_ONCE(drv_data->suspended, false);
+	return error;
 }
 
 static int sx9324_resume(struct device *dev)
 {
-	return 0;
+	struct sx9324_data *drv_data =
+		(struct sx9324_data *)i2c_get_clientdata(to_client(dev));
+	int error = 0;
+
+	if (drv_data->wake_armed) {
+		disable_irq_wake(drv_data->nirq);
+		drv_data->wake_armed = false;
+		error = sx9324_irq_demand(drv_data, 0, SX9324_IRQ_ESSENTIAL);
+		if (!error)
+			error = sx9324_set_mode(dev, drv_data->saved_mode);
+		if (error)
+			pr_err("failed to restore the chip state, err=%d\n", error);
+	}
+
+	WRITE_ONCE(drv_data->suspended, false);
+	if (drv_data->irq_pending) {
+		drv_data->irq_pending = false;
+		kthread_queue_work(drv_data->worker, &drv_data->nirq_work);
+	}
+	if (drv_data->polling)
+		sx9324_start_polling(drv_data);
+
+	return error;
 }
 
 static SIMPLE_DEV_PM_OPS(sx9324_pm_ops, sx9324_suspend, sx9324_resume);
@@ -890,6 +4510,68 @@ static const struct of_device_id sx9324_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, sx9324_of_match);
 
+static ssize_t phdata_all_show(struct device_driver *drv, char *buf)
+{
+	struct sx9324_batch_item *items;
+	struct sx9324_data *drv_data;
+	struct sx9324_phase_data *phdata;
+	int count = 0;
+	int written = 0;
+	int i, j;
+	int error;
+
+	mutex_lock(&sx9324_devices_lock);
+	list_for_each_entry(drv_data, &sx9324_devices, node)
+		count++;
+
+	items = kcalloc(max(count, 1), sizeof(*items), GFP_KERNEL);
+	if (!items) {
+		mutex_unlock(&sx9324_devices_lock);
+		return -ENOMEM;
+	}
+
+	i = 0;
+	list_for_each_entry(drv_data, &sx9324_devices, node)
+		items[i++].drv_data = drv_data;
+
+	/* chips stay on the list until all the reads are done */
+	error = sx9324_read_phdata_batch(items, count);
+	mutex_unlock(&sx9324_devices_lock);
+
+	written += scnprintf(buf + written, PAGE_SIZE - written,
+		"Device PH Useful Avg Diff Steady Prox Table Body Fail Comp\n");
+	written += scnprintf(buf + written, PAGE_SIZE - written,
+		"==========================================================\n");
+	for (i = 0; !error && i < count; i++) {
+		if (items[i].error) {
+			pr_err("failed to read phase data of %s, err=%d\n",
+				dev_name(&items[i].drv_data->client->dev), items[i].error);
+			continue;
+		}
+		for (j = PH0; j < SX9324_PHASES; j++) {
+			phdata = &items[i].phdata[j];
+			if (phdata->is_valid) {
+				written += scnprintf(buf + written, PAGE_SIZE - written,
+					"%s %d %d %d %d %d %d %d %d %d %d\n",
+					dev_name(&items[i].drv_data->client->dev), j,
+					phdata->proxuseful, phdata->proxavg, phdata->proxdiff,
+					phdata->stat.steady, phdata->stat.prox, phdata->stat.table,
+					phdata->stat.body, phdata->stat.fail, phdata->stat.comp);
+			}
+		}
+	}
+
+	kfree(items);
+	return error ? error : written;
+}
+static DRIVER_ATTR_RO(phdata_all);
+
+static struct attribute *sx9324_driver_attrs[] = {
+	&driver_attr_phdata_all.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(sx9324_driver);
+
 static struct i2c_driver sx9324_driver = {
 	.probe = sx9324_probe,
 	.remove = sx9324_remove,
@@ -897,6 +4579,7 @@ static struct i2c_driver sx9324_driver = {
 		.name = DRIVER_NAME,
 		.of_match_table = of_match_ptr(sx9324_of_match),
 		.pm = &sx9324_pm_ops,
+		.groups = sx9324_driver_groups,
 	},
 	.id_table = sx9324_id,
 };
@@ -905,3 +4588,7 @@ module_i2c_driver(sx9324_driver);
 MODULE_AUTHOR("Hsinko Yu <hsinkoyu@fih-foxconn.com>");
 MODULE_DESCRIPTION("Driver for Semtech SX9324");
 MODULE_LICENSE("GPL v2");
+
+#if IS_ENABLED(CONFIG_SX9324_KUNIT_TEST)
+#include "sx9324_test.c"
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Semtech SX9324 - a capacitive Specific Absorption Rate (SAR) controller
+ *
+ * Copyright (C) 2020 FIH Mobile Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _SX9324_H
+#define _SX9324_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * Record returned by read() on /dev/sx9324-group<id>, one per change of the
+ * combined decision of all the chips in a group.
+ */
+struct sx9324_group_event {
+	__u64 timestamp_ns; /* CLOCK_BOOTTIME of the change */
+	__u32 close; /* 1 if any phase of any member is close */
+	__u32 close_members; /* number of members having a close phase */
+};
+
+/*
+ * Phase data record returned by read() on /dev/sx9324-<dev>, one per
+ * acquisition. Fields are laid out per field, each an array holding all
+ * the phases, so one vector load takes a field of every phase; phase n is
+ * index n of the arrays and bit n of the masks.
+ */
+struct sx9324_sample {
+	__u64 timestamp_ns; /* CLOCK_MONOTONIC of the acquisition */
+	__s16 useful[4];
+	__s16 avg[4];
+	__s16 diff[4];
+	__u8 valid; /* enabled phases, the others are 0 */
+	__u8 steady;
+	__u8 prox;
+	__u8 table;
+	__u8 body;
+	__u8 fail;
+	__u8 comp;
+	__u8 reserved;
+};
+
+#define SX9324_TRACE_READ	0x01
+#define SX9324_TRACE_WRITE	0x02
+
+/*
+ * Register access captured by debugfs/sx9324-<dev>/trace, one per register
+ * of a burst. The same records are written to debugfs/sx9324-<dev>/replay
+ * to run them through the prox filter again.
+ */
+struct sx9324_trace_record {
+	__u32 time_us; /* since the capture started, wraps around */
+	__u8 reg;
+	__u8 val;
+	__u8 flags; /* SX9324_TRACE_READ or SX9324_TRACE_WRITE */
+	__u8 reserved;
+};
+
+#define SX9324_REG_WRITE	0x01
+
+/*
+ * Register operation of a SX9324_IOC_REG_BATCH batch, a read unless
+ * SX9324_REG_WRITE is set. val is what to write or what was read back.
+ */
+struct sx9324_reg_op {
+	__u8 reg;
+	__u8 val;
+	__u8 flags;
+	__u8 reserved;
+	__s32 result; /* 0 or -errno of the operation */
+};
+
+/* up to SX9324_REG_BATCH_MAX operations in one ioctl */
+#define SX9324_REG_BATCH_MAX	1024
+
+struct sx9324_reg_batch {
+	__u64 ops; /* pointer to an array of struct sx9324_reg_op */
+	__u32 count;
+	__u32 done; /* operations run, the batch stops at the first failure */
+};
+
+/*
+ * ioctl on /dev/sx9324-<dev>, operations on adjacent registers in the same
+ * direction are merged into bulk transfers. Reads return what the chip
+ * holds, not the driver's register cache. Writes need the device opened
+ * for writing.
+ */
+#define SX9324_IOC_MAGIC		'S'
+#define SX9324_IOC_REG_BATCH	_IOWR(SX9324_IOC_MAGIC, 0x01, \
+	struct sx9324_reg_batch)
+
+#endif /* _SX9324_H */
@@ -0,0 +1,800 @@
+/*
+ * Semtech SX9324 - KUnit tests of the driver, built into it by
+ * CONFIG_SX9324_KUNIT_TEST to reach its static functions
+ *
+ * Copyright (C) 2020 FIH Mobile Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <kunit/test.h>
+#include <linux/gpio/driver.h>
+
+/*
+ * A fake chip behind a fake I2C adapter. The driver reaches it through its
+ * own regmap bus, sx9324_regmap_bus, and the combined phase transfers, so
+ * every bus operation is a counted call of sx9324_test_xfer().
+ */
+struct sx9324_test_chip {
+	struct i2c_adapter adapter;
+	struct i2c_client client;
+	struct gpio_chip gpio;
+	bool gpio_added;
+	u8 regs[SX9324_REV + 1];
+	/* PROXUSEFUL to SAR of each phase, paged by PHASE_SEL */
+	u8 phase_regs[SX9324_PHASES][SX9324_SAR_LSB - SX9324_USE_MSB + 1];
+	/* NIRQ is active low, asserted until IRQ_SRC is read */
+	bool nirq_asserted;
+	/* the NIRQ handler clears the reset interrupt before the driver looks */
+	bool reset_nirq_cleared;
+	/* reading IRQ_SRC does not release NIRQ */
+	bool nirq_stuck;
+	unsigned int transfers;
+	struct sx9324_data *drv_data;
+};
+
+static u8 sx9324_test_read(struct sx9324_test_chip *chip, u8 reg)
+{
+	u8 val;
+
+	if (reg >= SX9324_USE_MSB && reg <= SX9324_SAR_LSB)
+		return chip->phase_regs[chip->regs[SX9324_PHASE_SEL] %
+			SX9324_PHASES][reg - SX9324_USE_MSB];
+
+	val = chip->regs[reg];
+	/* IRQ_SRC is cleared on read */
+	if (reg == SX9324_IRQ_SRC) {
+		chip->regs[reg] = 0;
+		if (!chip->nirq_stuck)
+			chip->nirq_asserted = false;
+	}
+
+	return val;
+}
+
+static void sx9324_test_write(struct sx9324_test_chip *chip, u8 reg, u8 val)
+{
+	if (reg != SX9324_RESET) {
+		chip->regs[reg] = val;
+		return;
+	}
+
+	if (val != 0xde)
+		return;
+
+	/* back to hardware defaults, taken as 0, reporting the reset */
+	memset(chip->regs, 0, sizeof(chip->regs));
+	if (!chip->reset_nirq_cleared) {
+		chip->regs[SX9324_IRQ_SRC] = SX9324_RESETIRQ;
+		chip->nirq_asserted = true;
+	}
+}
+
+static int sx9324_test_xfer(struct i2c_adapter *adapter, struct i2c_msg *msgs,
+	int num)
+{
+	struct sx9324_test_chip *chip = container_of(adapter,
+		struct sx9324_test_chip, adapter);
+	u8 reg = 0;
+	int i, k;
+
+	chip->transfers++;
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			for (k = 0; k < msgs[i].len; k++)
+				msgs[i].buf[k] = sx9324_test_read(chip, reg++);
+		} else if (msgs[i].len) {
+			/* register auto-increment, as the driver relies on */
+			reg = msgs[i].buf[0];
+			for (k = 1; k < msgs[i].len; k++)
+				sx9324_test_write(chip, reg++, msgs[i].buf[k]);
+		}
+	}
+
+	return num;
+}
+
+static u32 sx9324_test_functionality(struct i2c_adapter *adapter)
+{
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm sx9324_test_algo = {
+	.master_xfer = sx9324_test_xfer,
+	.functionality = sx9324_test_functionality,
+};
+
+/* the adapter is not registered, nothing else is on its bus */
+static void sx9324_test_lock_bus(struct i2c_adapter *adapter,
+	unsigned int flags)
+{
+}
+
+static int sx9324_test_trylock_bus(struct i2c_adapter *adapter,
+	unsigned int flags)
+{
+	return 1;
+}
+
+static void sx9324_test_unlock_bus(struct i2c_adapter *adapter,
+	unsigned int flags)
+{
+}
+
+static const struct i2c_lock_operations sx9324_test_lock_ops = {
+	.lock_bus = sx9324_test_lock_bus,
+	.trylock_bus = sx9324_test_trylock_bus,
+	.unlock_bus = sx9324_test_unlock_bus,
+};
+
+static int sx9324_test_gpio_get(struct gpio_chip *gc, unsigned int offset)
+{
+	struct sx9324_test_chip *chip = gpiochip_get_data(gc);
+
+	return !chip->nirq_asserted;
+}
+
+static void sx9324_test_release(struct device *dev)
+{
+}
+
+static int sx9324_test_init(struct kunit *test)
+{
+	struct sx9324_test_chip *chip;
+	struct sx9324_data *drv_data;
+	int error;
+
+	chip = kunit_kzalloc(test, sizeof(*chip), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, chip);
+	drv_data = kunit_kzalloc(test, sizeof(*drv_data), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, drv_data);
+	chip->drv_data = drv_data;
+	test->priv = chip;
+
+	strscpy(chip->adapter.name, "sx9324-test", sizeof(chip->adapter.name));
+	chip->adapter.algo = &sx9324_test_algo;
+	chip->adapter.lock_ops = &sx9324_test_lock_ops;
+	chip->adapter.timeout = HZ;
+	chip->client.adapter = &chip->adapter;
+	chip->client.addr = 0x28;
+	device_initialize(&chip->client.dev);
+	chip->client.dev.release = sx9324_test_release;
+	error = dev_set_name(&chip->client.dev, "sx9324-test");
+	KUNIT_ASSERT_EQ(test, error, 0);
+
+	/* as probe sets up what the tested paths use */
+	drv_data->client = &chip->client;
+	mutex_init(&drv_data->phdata_lock);
+	mutex_init(&drv_data->irq_lock);
+	mutex_init(&drv_data->acquire_lock);
+	seqlock_init(&drv_data->snapshot_lock);
+	spin_lock_init(&drv_data->io_lock);
+	mutex_init(&drv_data->trace_lock);
+	spin_lock_init(&drv_data->latency_lock);
+	i2c_set_clientdata(&chip->client, drv_data);
+
+	drv_data->regmap = regmap_init(&chip->client.dev, &sx9324_regmap_bus,
+		drv_data, &sx9324_regmap_config);
+	KUNIT_ASSERT_FALSE(test, IS_ERR(drv_data->regmap));
+
+	chip->gpio.label = "sx9324-test-nirq";
+	chip->gpio.owner = THIS_MODULE;
+	chip->gpio.base = -1;
+	chip->gpio.ngpio = 1;
+	chip->gpio.get = sx9324_test_gpio_get;
+	error = gpiochip_add_data(&chip->gpio, chip);
+	KUNIT_ASSERT_EQ(test, error, 0);
+	chip->gpio_added = true;
+	drv_data->nirq_gpio = gpio_to_desc(chip->gpio.base);
+	KUNIT_ASSERT_NOT_NULL(test, drv_data->nirq_gpio);
+
+	return 0;
+}
+
+static void sx9324_test_exit(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+
+	if (!chip)
+		return;
+
+	if (chip->gpio_added)
+		gpiochip_remove(&chip->gpio);
+	if (!IS_ERR_OR_NULL(chip->drv_data->regmap))
+		regmap_exit(chip->drv_data->regmap);
+	put_device(&chip->client.dev);
+}
+
+/* a 16 bits register pair of a phase, MSB first */
+static void sx9324_test_set_phase(struct sx9324_test_chip *chip, int phase,
+	u8 reg, u16 val)
+{
+	chip->phase_regs[phase][reg - SX9324_USE_MSB] = val >> 8;
+	chip->phase_regs[phase][reg - SX9324_USE_MSB + 1] = val & 0xff;
+}
+
+static void sx9324_test_read_phdata(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_phase_data phdata[SX9324_PHASES];
+	int error;
+
+	/* phases 0 and 2 enabled */
+	chip->regs[SX9324_GNRL_CTRL_1] = 0x25;
+	/* phase 0 prox/table/comp, phase 2 steady/body/fail */
+	chip->regs[SX9324_STAT_0] = BIT(2 + 4) | BIT(0);
+	chip->regs[SX9324_STAT_1] = BIT(0 + 4) | BIT(2);
+	chip->regs[SX9324_STAT_2] = BIT(2 + 4) | BIT(0);
+
+	sx9324_test_set_phase(chip, 0, SX9324_USE_MSB, 0xff38);
+	sx9324_test_set_phase(chip, 0, SX9324_AVG_MSB, 0x7fff);
+	sx9324_test_set_phase(chip, 0, SX9324_DIFF_MSB, 0x8000);
+	sx9324_test_set_phase(chip, 1, SX9324_USE_MSB, 0x1234);
+	sx9324_test_set_phase(chip, 2, SX9324_USE_MSB, 0x0064);
+	sx9324_test_set_phase(chip, 2, SX9324_AVG_MSB, 0xfffe);
+	sx9324_test_set_phase(chip, 2, SX9324_DIFF_MSB, 0x0001);
+
+	error = sx9324_read_phdata(&chip->client.dev, phdata);
+	KUNIT_ASSERT_EQ(test, error, 0);
+	/* GNRL_CTRL_1, the status burst and one transfer per enabled phase */
+	KUNIT_EXPECT_EQ(test, chip->transfers, 4U);
+
+	KUNIT_EXPECT_TRUE(test, phdata[0].is_valid);
+	KUNIT_EXPECT_EQ(test, phdata[0].proxuseful, -200);
+	KUNIT_EXPECT_EQ(test, phdata[0].proxavg, 32767);
+	KUNIT_EXPECT_EQ(test, phdata[0].proxdiff, -32768);
+	KUNIT_EXPECT_TRUE(test, phdata[0].stat.prox);
+	KUNIT_EXPECT_FALSE(test, phdata[0].stat.steady);
+	KUNIT_EXPECT_TRUE(test, phdata[0].stat.table);
+	KUNIT_EXPECT_FALSE(test, phdata[0].stat.body);
+	KUNIT_EXPECT_TRUE(test, phdata[0].stat.comp);
+	KUNIT_EXPECT_FALSE(test, phdata[0].stat.fail);
+
+	KUNIT_EXPECT_FALSE(test, phdata[1].is_valid);
+	KUNIT_EXPECT_FALSE(test, phdata[3].is_valid);
+
+	KUNIT_EXPECT_TRUE(test, phdata[2].is_valid);
+	KUNIT_EXPECT_EQ(test, phdata[2].proxuseful, 100);
+	KUNIT_EXPECT_EQ(test, phdata[2].proxavg, -2);
+	KUNIT_EXPECT_EQ(test, phdata[2].proxdiff, 1);
+	KUNIT_EXPECT_FALSE(test, phdata[2].stat.prox);
+	KUNIT_EXPECT_TRUE(test, phdata[2].stat.steady);
+	KUNIT_EXPECT_FALSE(test, phdata[2].stat.table);
+	KUNIT_EXPECT_TRUE(test, phdata[2].stat.body);
+	KUNIT_EXPECT_FALSE(test, phdata[2].stat.comp);
+	KUNIT_EXPECT_TRUE(test, phdata[2].stat.fail);
+
+	/* GNRL_CTRL_1 is cached from now on */
+	chip->transfers = 0;
+	error = sx9324_read_phdata(&chip->client.dev, phdata);
+	KUNIT_ASSERT_EQ(test, error, 0);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 3U);
+	KUNIT_EXPECT_EQ(test, chip->drv_data->io_stats.transfers, 7ULL);
+}
+
+static void sx9324_test_read_phdata_sleep(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_phase_data phdata[SX9324_PHASES];
+	int i;
+
+	/* no phase enabled, nothing read past GNRL_CTRL_1 */
+	chip->regs[SX9324_GNRL_CTRL_1] = 0x20;
+	KUNIT_ASSERT_EQ(test, sx9324_read_phdata(&chip->client.dev, phdata), 0);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+	for (i = PH0; i < SX9324_PHASES; i++)
+		KUNIT_EXPECT_FALSE(test, phdata[i].is_valid);
+}
+
+static void sx9324_test_expect_mode(struct kunit *test,
+	enum sx9324_operational_mode expected)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	enum sx9324_operational_mode mode;
+
+	KUNIT_ASSERT_EQ(test, sx9324_get_mode(&chip->client.dev, &mode), 0);
+	KUNIT_EXPECT_EQ(test, mode, expected);
+}
+
+static void sx9324_test_mode(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct device *dev = &chip->client.dev;
+
+	chip->regs[SX9324_GNRL_CTRL_0] = 0x05;
+	chip->regs[SX9324_GNRL_CTRL_1] = 0x20;
+	sx9324_test_expect_mode(test, SX9324_SLEEP);
+	/* GNRL_CTRL_0 is not looked at while sleeping */
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+
+	/* without software defaults all the phases are enabled */
+	chip->transfers = 0;
+	KUNIT_ASSERT_EQ(test, sx9324_set_mode(dev, SX9324_ACTIVE), 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_1], 0x2f);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_0], 0x05);
+	/* GNRL_CTRL_1 written, GNRL_CTRL_0 read and left as is */
+	KUNIT_EXPECT_EQ(test, chip->transfers, 2U);
+
+	chip->transfers = 0;
+	sx9324_test_expect_mode(test, SX9324_ACTIVE);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 0U);
+
+	chip->transfers = 0;
+	KUNIT_ASSERT_EQ(test, sx9324_set_mode(dev, SX9324_DOZE), 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_1], 0x2f);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_0], 0x45);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+
+	chip->transfers = 0;
+	sx9324_test_expect_mode(test, SX9324_DOZE);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 0U);
+
+	chip->transfers = 0;
+	KUNIT_ASSERT_EQ(test, sx9324_set_mode(dev, SX9324_SLEEP), 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_1], 0x20);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_0], 0x45);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+	sx9324_test_expect_mode(test, SX9324_SLEEP);
+
+	KUNIT_EXPECT_EQ(test, sx9324_set_mode(dev, SX9324_SLEEP + 1), -EINVAL);
+}
+
+static void sx9324_test_mode_defaults(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct device *dev = &chip->client.dev;
+	struct reg_default defaults[] = {
+		{ SX9324_GNRL_CTRL_0, 0x25 },
+		{ SX9324_GNRL_CTRL_1, 0x23 },
+	};
+
+	/* the software defaults pick the phases and the doze period */
+	chip->drv_data->reg_defaults = defaults;
+	chip->drv_data->num_reg_defaults = ARRAY_SIZE(defaults);
+	chip->regs[SX9324_GNRL_CTRL_0] = 0x05;
+	chip->regs[SX9324_GNRL_CTRL_1] = 0x20;
+
+	KUNIT_ASSERT_EQ(test, sx9324_set_mode(dev, SX9324_DOZE), 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_1], 0x23);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_0], 0x25);
+	sx9324_test_expect_mode(test, SX9324_DOZE);
+
+	KUNIT_ASSERT_EQ(test, sx9324_set_mode(dev, SX9324_ACTIVE), 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_GNRL_CTRL_0], 0x05);
+	sx9324_test_expect_mode(test, SX9324_ACTIVE);
+
+	chip->drv_data->reg_defaults = NULL;
+	chip->drv_data->num_reg_defaults = 0;
+}
+
+/* "semtech,reg-init" is written as given, GNRL_CTRL_1 last */
+static void sx9324_test_init_sequence(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_data *drv_data = chip->drv_data;
+	struct reg_default defaults[] = {
+		{ SX9324_IRQ_MSK, 0x60 },
+		{ SX9324_GNRL_CTRL_1, 0x2f },
+		{ SX9324_PHASE_SEL, 1 },
+	};
+	struct reg_default init[] = {
+		{ SX9324_PHASE_SEL, 0 },
+		{ SX9324_GNRL_CTRL_1, 0x2f },
+		{ SX9324_PHASE_SEL, 1 },
+	};
+	const struct reg_default expected[] = {
+		{ SX9324_IRQ_MSK, 0x60 },
+		{ SX9324_PHASE_SEL, 0 },
+		{ SX9324_PHASE_SEL, 1 },
+		{ SX9324_GNRL_CTRL_1, 0x2f },
+	};
+	struct sx9324_trace_record *rec;
+	int i;
+
+	drv_data->reg_defaults = defaults;
+	drv_data->num_reg_defaults = ARRAY_SIZE(defaults);
+	drv_data->reg_init = init;
+	drv_data->num_reg_init = ARRAY_SIZE(init);
+
+	KUNIT_ASSERT_EQ(test, sx9324_enable_trace(drv_data, true), 0);
+	KUNIT_ASSERT_EQ(test, sx9324_reset_software_default(&chip->client.dev),
+		0);
+	KUNIT_ASSERT_EQ(test, drv_data->trace_head - drv_data->trace_tail,
+		(unsigned int)ARRAY_SIZE(expected));
+	for (i = 0; i < ARRAY_SIZE(expected); i++) {
+		rec = &drv_data->trace[drv_data->trace_tail++ % SX9324_TRACE_RECORDS];
+		KUNIT_EXPECT_EQ(test, rec->flags, SX9324_TRACE_WRITE);
+		KUNIT_EXPECT_EQ(test, rec->reg, expected[i].reg);
+		KUNIT_EXPECT_EQ(test, rec->val, expected[i].def);
+	}
+	sx9324_enable_trace(drv_data, false);
+
+	drv_data->reg_defaults = NULL;
+	drv_data->num_reg_defaults = 0;
+	drv_data->reg_init = NULL;
+	drv_data->num_reg_init = 0;
+}
+
+static void sx9324_test_reset(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_data *drv_data = chip->drv_data;
+	unsigned int val;
+
+	chip->regs[SX9324_GNRL_CTRL_1] = 0x2f;
+	KUNIT_ASSERT_EQ(test, regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_1,
+		&val), 0);
+	chip->transfers = 0;
+	/* the demand is programmed again once the chip is back */
+	drv_data->irq_demand[6] = 1;
+	drv_data->irq_msk = SX9324_CLOSEANYIRQEN;
+	chip->regs[SX9324_IRQ_MSK] = SX9324_CLOSEANYIRQEN;
+
+	KUNIT_ASSERT_EQ(test, sx9324_reset(&chip->client.dev, SOFTWARE_RESET), 0);
+	KUNIT_EXPECT_FALSE(test, chip->nirq_asserted);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_IRQ_SRC], 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_IRQ_MSK], SX9324_CLOSEANYIRQEN);
+	KUNIT_EXPECT_FALSE(test, drv_data->resetting);
+	/* RESET, IRQ_SRC releasing NIRQ, IRQ_MSK */
+	KUNIT_EXPECT_EQ(test, chip->transfers, 3U);
+
+	/* the cache went back to hardware defaults with the chip */
+	chip->transfers = 0;
+	KUNIT_ASSERT_EQ(test, regmap_read(drv_data->regmap, SX9324_GNRL_CTRL_1,
+		&val), 0);
+	KUNIT_EXPECT_EQ(test, val, 0U);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+}
+
+static void sx9324_test_reset_nirq_cleared(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+
+	/* IRQ_SRC already read by the NIRQ handler is not read again */
+	chip->reset_nirq_cleared = true;
+	KUNIT_ASSERT_EQ(test, sx9324_reset(&chip->client.dev, SOFTWARE_RESET), 0);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 2U);
+	KUNIT_EXPECT_FALSE(test, chip->drv_data->resetting);
+}
+
+static void sx9324_test_reset_nirq_stuck(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+
+	chip->nirq_stuck = true;
+	KUNIT_EXPECT_EQ(test, sx9324_reset(&chip->client.dev, SOFTWARE_RESET),
+		-ENODEV);
+	/* RESET and IRQ_SRC, the interrupt sources are left alone */
+	KUNIT_EXPECT_EQ(test, chip->transfers, 2U);
+	KUNIT_EXPECT_FALSE(test, chip->drv_data->resetting);
+}
+
+static void sx9324_test_reset_no_nirq(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+
+	/* NIRQ not wired, IRQ_SRC is read regardless */
+	chip->drv_data->nirq_gpio = NULL;
+	chip->reset_nirq_cleared = true;
+	KUNIT_ASSERT_EQ(test, sx9324_reset(&chip->client.dev, SOFTWARE_RESET), 0);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 3U);
+}
+
+static void sx9324_test_reset_power_up(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+
+	/* the chip comes up reporting its reset, nothing is written */
+	chip->regs[SX9324_IRQ_SRC] = SX9324_RESETIRQ;
+	chip->nirq_asserted = true;
+	KUNIT_ASSERT_EQ(test, sx9324_reset(&chip->client.dev, POWER_UP_RESET), 0);
+	KUNIT_EXPECT_FALSE(test, chip->nirq_asserted);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+}
+
+/* the prox filter of phase 0, fed with samples 10ms apart */
+struct sx9324_test_filter {
+	struct sx9324_filter_cfg cfg;
+	struct sx9324_prox_filter filter[SX9324_PHASES];
+	unsigned int retry_ms;
+};
+
+static u8 sx9324_test_filter(struct sx9324_test_filter *tf, bool close,
+	const int diff[], unsigned int ms)
+{
+	return sx9324_filter_prox(&tf->cfg, tf->filter, close ? BIT(0) : 0,
+		diff, diff ? 0x0f : 0, 0, ms_to_ktime(ms), 10, &tf->retry_ms);
+}
+
+static void sx9324_test_filter_debounce(struct kunit *test)
+{
+	struct sx9324_test_filter tf = { .cfg = { .debounce = 3 } };
+
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, NULL, 10), 0);
+	/* re-sampled at the scan period while the change is pending */
+	KUNIT_EXPECT_EQ(test, tf.retry_ms, 10U);
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, NULL, 20), 0);
+	/* a sample agreeing with the decision starts the count again */
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, false, NULL, 30), 0);
+	KUNIT_EXPECT_EQ(test, tf.retry_ms, 0U);
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, NULL, 40), 0);
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, NULL, 50), 0);
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, NULL, 60), BIT(0));
+	KUNIT_EXPECT_EQ(test, tf.retry_ms, 0U);
+	KUNIT_EXPECT_EQ(test, tf.filter[0].last_change, ms_to_ktime(60));
+}
+
+static void sx9324_test_filter_holdoff(struct kunit *test)
+{
+	struct sx9324_test_filter tf = { .cfg = { .holdoff_ms = 100 } };
+
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, NULL, 10), BIT(0));
+	/* too soon after the last decision, retried once the holdoff ends */
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, false, NULL, 50), BIT(0));
+	KUNIT_EXPECT_EQ(test, tf.retry_ms, 60U);
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, false, NULL, 110), 0);
+}
+
+static void sx9324_test_filter_hysteresis(struct kunit *test)
+{
+	struct sx9324_test_filter tf = { .cfg = { .hysteresis = 50 } };
+	int diff[SX9324_PHASES] = { 200 };
+
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, diff, 10), BIT(0));
+	KUNIT_EXPECT_EQ(test, tf.filter[0].close_diff, 200);
+	/* a far sample within the hysteresis of the close level is not one */
+	diff[0] = 160;
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, false, diff, 20), BIT(0));
+	KUNIT_EXPECT_EQ(test, tf.retry_ms, 10U);
+	diff[0] = 140;
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, false, diff, 30), 0);
+
+	/* without proxdiff the far sample is taken as is */
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, diff, 40), BIT(0));
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, false, NULL, 50), 0);
+
+	/* decided close without proxdiff, the next one sets the close level */
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, NULL, 60), BIT(0));
+	KUNIT_EXPECT_FALSE(test, tf.filter[0].close_diff_valid);
+	diff[0] = 200;
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, true, diff, 70), BIT(0));
+	KUNIT_EXPECT_TRUE(test, tf.filter[0].close_diff_valid);
+	diff[0] = 160;
+	KUNIT_EXPECT_EQ(test, sx9324_test_filter(&tf, false, diff, 80), BIT(0));
+}
+
+/* a debounced change is published with the NIRQ edge it was first seen on */
+static void sx9324_test_filter_origin(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_data *drv_data = chip->drv_data;
+
+	drv_data->worker = kthread_create_worker(0, "sx9324-test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, drv_data->worker);
+	kthread_init_delayed_work(&drv_data->filter_work, sx9324_filter_worker);
+	drv_data->filter_cfg.debounce = 2;
+	/* the filter retry is left pending, the test re-samples in its place */
+	drv_data->scan_period_ms = 60000;
+
+	chip->regs[SX9324_IRQ_SRC] = SX9324_CLOSEANYIRQ;
+	chip->regs[SX9324_STAT_0] = BIT(0);
+	sx9324_sample_prox(drv_data, 1000);
+	KUNIT_EXPECT_EQ(test, drv_data->prox_state, 0);
+	KUNIT_EXPECT_EQ(test, drv_data->event_origin, 0);
+	sx9324_sample_prox(drv_data, 0);
+	KUNIT_EXPECT_EQ(test, drv_data->prox_state, BIT(0));
+	KUNIT_EXPECT_EQ(test, drv_data->event_origin, 1000);
+
+	/* a change seen on re-samples only has no edge to time it from */
+	drv_data->event_origin = 0;
+	chip->regs[SX9324_STAT_0] = 0;
+	sx9324_sample_prox(drv_data, 0);
+	sx9324_sample_prox(drv_data, 0);
+	KUNIT_EXPECT_EQ(test, drv_data->prox_state, 0);
+	KUNIT_EXPECT_EQ(test, drv_data->event_origin, 0);
+
+	kthread_cancel_delayed_work_sync(&drv_data->filter_work);
+	kthread_destroy_worker(drv_data->worker);
+}
+
+/* the IRQ_SRC/STAT_0 burst of a sample, then proxdiff as for hysteresis */
+static void sx9324_test_sample(struct kunit *test, bool close, u16 diff)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	int val[SX9324_PHASES];
+	u8 buf[2];
+
+	chip->regs[SX9324_STAT_0] = close ? BIT(0) : 0;
+	sx9324_test_set_phase(chip, 0, SX9324_DIFF_MSB, diff);
+	KUNIT_ASSERT_EQ(test, regmap_bulk_read(chip->drv_data->regmap,
+		SX9324_IRQ_SRC, buf, sizeof(buf)), 0);
+	KUNIT_ASSERT_EQ(test, sx9324_read_proxdiff(&chip->client.dev, BIT(0),
+		val), 0);
+}
+
+/* a capture of three samples replayed through the prox filter */
+static void sx9324_test_trace_replay(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_data *drv_data = chip->drv_data;
+	struct sx9324_trace_record recs[15];
+	struct sx9324_replay *replay;
+	const char *close, *far;
+	int i;
+
+	KUNIT_ASSERT_EQ(test, sx9324_enable_trace(drv_data, true), 0);
+	sx9324_test_sample(test, true, 200);
+	/* within the hysteresis of the close level, then out of it */
+	sx9324_test_sample(test, false, 180);
+	sx9324_test_sample(test, false, 100);
+
+	/* a register per record, the register pointer write is not one */
+	KUNIT_ASSERT_EQ(test, drv_data->trace_head - drv_data->trace_tail,
+		(unsigned int)ARRAY_SIZE(recs));
+	for (i = 0; i < ARRAY_SIZE(recs); i++)
+		recs[i] = drv_data->trace[drv_data->trace_tail++ %
+			SX9324_TRACE_RECORDS];
+	sx9324_enable_trace(drv_data, false);
+	KUNIT_EXPECT_EQ(test, recs[0].reg, SX9324_IRQ_SRC);
+	KUNIT_EXPECT_EQ(test, recs[0].flags, SX9324_TRACE_READ);
+	KUNIT_EXPECT_EQ(test, recs[1].reg, SX9324_STAT_0);
+	KUNIT_EXPECT_EQ(test, recs[1].flags, SX9324_TRACE_READ);
+	KUNIT_EXPECT_EQ(test, recs[1].time_us, recs[0].time_us);
+	KUNIT_EXPECT_EQ(test, recs[1].val, BIT(0));
+	KUNIT_EXPECT_EQ(test, recs[2].reg, SX9324_PHASE_SEL);
+	KUNIT_EXPECT_EQ(test, recs[2].flags, SX9324_TRACE_WRITE);
+	KUNIT_EXPECT_EQ(test, recs[3].reg, SX9324_DIFF_MSB);
+	KUNIT_EXPECT_EQ(test, recs[4].reg, SX9324_DIFF_LSB);
+	KUNIT_EXPECT_EQ(test, recs[4].val, 200);
+	KUNIT_EXPECT_EQ(test, recs[6].val, 0);
+
+	replay = kunit_kzalloc(test, sizeof(*replay), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, replay);
+	replay->out = kunit_kzalloc(test, SX9324_REPLAY_OUTPUT_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, replay->out);
+	replay->drv_data = drv_data;
+	replay->cfg.hysteresis = 50;
+	for (i = 0; i < ARRAY_SIZE(recs); i++)
+		sx9324_replay_record(replay, &recs[i]);
+	/* the last sample is decided when the output is read */
+	KUNIT_EXPECT_EQ(test, replay->samples, 2ULL);
+	sx9324_replay_sample(replay);
+	KUNIT_EXPECT_EQ(test, replay->samples, 3ULL);
+	KUNIT_EXPECT_EQ(test, replay->diff_missing, 0ULL);
+
+	/* close on the first sample, far on the third only */
+	close = strstr(replay->out, " phase=0 close\n");
+	KUNIT_ASSERT_NOT_NULL(test, close);
+	far = strstr(close, " phase=0 far\n");
+	KUNIT_ASSERT_NOT_NULL(test, far);
+	KUNIT_EXPECT_EQ(test, (size_t)(far - replay->out) +
+		strlen(" phase=0 far\n"), replay->out_len);
+}
+
+/* CONVDONE is enabled while it has users, the snapshot dropped after */
+static void sx9324_test_convdone_demand(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_data *drv_data = chip->drv_data;
+
+	drv_data->irq_demand[6] = 1;
+	drv_data->irq_msk = SX9324_CLOSEANYIRQEN;
+	chip->regs[SX9324_IRQ_MSK] = SX9324_CLOSEANYIRQEN;
+	drv_data->snapshot.is_valid = true;
+
+	KUNIT_ASSERT_EQ(test, sx9324_convdone_demand(drv_data, true), 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_IRQ_MSK],
+		SX9324_CLOSEANYIRQEN | SX9324_CONVDONEIRQEN);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+	KUNIT_ASSERT_EQ(test, sx9324_convdone_demand(drv_data, true), 0);
+	KUNIT_EXPECT_EQ(test, drv_data->convdone_users, 2U);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+
+	KUNIT_ASSERT_EQ(test, sx9324_convdone_demand(drv_data, false), 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_IRQ_MSK],
+		SX9324_CLOSEANYIRQEN | SX9324_CONVDONEIRQEN);
+	KUNIT_EXPECT_TRUE(test, drv_data->snapshot.is_valid);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+
+	KUNIT_ASSERT_EQ(test, sx9324_convdone_demand(drv_data, false), 0);
+	KUNIT_EXPECT_EQ(test, drv_data->convdone_users, 0U);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_IRQ_MSK], SX9324_CLOSEANYIRQEN);
+	KUNIT_EXPECT_FALSE(test, drv_data->snapshot.is_valid);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 2U);
+}
+
+/* runs of adjacent registers in the same direction are single transfers */
+static void sx9324_test_reg_batch(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_reg_op ops[] = {
+		{ .reg = SX9324_STAT_0 },
+		{ .reg = SX9324_STAT_1 },
+		{ .reg = SX9324_PROX_CTRL_0, .val = 0x12, .flags = SX9324_REG_WRITE },
+		{ .reg = SX9324_PROX_CTRL_1, .val = 0x34, .flags = SX9324_REG_WRITE },
+		{ .reg = SX9324_PROX_CTRL_0 },
+		{ .reg = SX9324_PROX_CTRL_1 },
+	};
+	u32 done;
+
+	chip->regs[SX9324_STAT_0] = 0x41;
+	chip->regs[SX9324_STAT_1] = 0x14;
+	KUNIT_ASSERT_EQ(test, sx9324_reg_ops(chip->drv_data, ops,
+		ARRAY_SIZE(ops), &done), 0);
+	KUNIT_EXPECT_EQ(test, done, (u32)ARRAY_SIZE(ops));
+	KUNIT_EXPECT_EQ(test, ops[0].val, 0x41);
+	KUNIT_EXPECT_EQ(test, ops[1].val, 0x14);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_PROX_CTRL_0], 0x12);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_PROX_CTRL_1], 0x34);
+	KUNIT_EXPECT_EQ(test, ops[4].val, 0x12);
+	KUNIT_EXPECT_EQ(test, ops[5].val, 0x34);
+	KUNIT_EXPECT_EQ(test, ops[5].result, 0);
+	/* the status, write and read-back bursts */
+	KUNIT_EXPECT_EQ(test, chip->transfers, 3U);
+
+	/* reads show the chip, not the register cache */
+	chip->regs[SX9324_PROX_CTRL_0] = 0x56;
+	KUNIT_ASSERT_EQ(test, sx9324_reg_ops(chip->drv_data, &ops[4], 1, &done),
+		0);
+	KUNIT_EXPECT_EQ(test, ops[4].val, 0x56);
+}
+
+static void sx9324_test_reg_batch_error(struct kunit *test)
+{
+	struct sx9324_test_chip *chip = test->priv;
+	struct sx9324_reg_op ops[] = {
+		{ .reg = SX9324_PROX_CTRL_0, .val = 0x12, .flags = SX9324_REG_WRITE },
+		{ .reg = SX9324_WHO_AM_I, .val = 0x23, .flags = SX9324_REG_WRITE },
+		{ .reg = SX9324_PROX_CTRL_0 },
+	};
+	u32 done;
+
+	/* the batch stops at the failed run, counted as done */
+	KUNIT_EXPECT_LT(test, sx9324_reg_ops(chip->drv_data, ops,
+		ARRAY_SIZE(ops), &done), 0);
+	KUNIT_EXPECT_EQ(test, done, 2U);
+	KUNIT_EXPECT_EQ(test, ops[0].result, 0);
+	KUNIT_EXPECT_LT(test, ops[1].result, 0);
+	KUNIT_EXPECT_EQ(test, ops[2].result, 0);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_PROX_CTRL_0], 0x12);
+	KUNIT_EXPECT_EQ(test, chip->regs[SX9324_WHO_AM_I], 0);
+	KUNIT_EXPECT_EQ(test, chip->transfers, 1U);
+}
+
+static struct kunit_case sx9324_test_cases[] = {
+	KUNIT_CASE(sx9324_test_read_phdata),
+	KUNIT_CASE(sx9324_test_read_phdata_sleep),
+	KUNIT_CASE(sx9324_test_mode),
+	KUNIT_CASE(sx9324_test_mode_defaults),
+	KUNIT_CASE(sx9324_test_init_sequence),
+	KUNIT_CASE(sx9324_test_reset),
+	KUNIT_CASE(sx9324_test_reset_nirq_cleared),
+	KUNIT_CASE(sx9324_test_reset_nirq_stuck),
+	KUNIT_CASE(sx9324_test_reset_no_nirq),
+	KUNIT_CASE(sx9324_test_reset_power_up),
+	KUNIT_CASE(sx9324_test_filter_debounce),
+	KUNIT_CASE(sx9324_test_filter_holdoff),
+	KUNIT_CASE(sx9324_test_filter_hysteresis),
+	KUNIT_CASE(sx9324_test_filter_origin),
+	KUNIT_CASE(sx9324_test_trace_replay),
+	KUNIT_CASE(sx9324_test_convdone_demand),
+	KUNIT_CASE(sx9324_test_reg_batch),
+	KUNIT_CASE(sx9324_test_reg_batch_error),
+	{}
+};
+
+static struct kunit_suite sx9324_test_suite = {
+	.name = "sx9324",
+	.init = sx9324_test_init,
+	.exit = sx9324_test_exit,
+	.test_cases = sx9324_test_cases,
+};
+kunit_test_suite(sx9324_test_suite);
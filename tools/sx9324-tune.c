@@ -0,0 +1,275 @@
+/*
+ * Semtech SX9324 - offline tuning of the proximity thresholds from phase
+ * data captured near and far
+ *
+ * Copyright (C) 2020 FIH Mobile Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Usage: sx9324-tune <near capture> <far capture>
+ *
+ * A capture is the struct sx9324_sample records read from /dev/sx9324-<dev>
+ * while an object is held near, respectively away from, the antenna, e.g.
+ * "cat /dev/sx9324-1-0028 > near.bin". Each capture is read once, keeping
+ * a proxdiff histogram and the statistics of every phase.
+ *
+ * The device tree tuning printed is:
+ * - PROX_CTRL_6/7, the threshold of phases 0/1 and 2/3, minimizing the
+ *   samples on the wrong side of it. The chip detects at value^2 / 2.
+ * - PROX_CTRL_5, the chip hysteresis covering twice the near noise and the
+ *   close/far debounce bringing the per sample error below one in a million.
+ * - semtech,prox-filter, with the host hysteresis of the driver at twice the
+ *   near noise below the close level.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libsx9324.h"
+
+#define PROX_CTRL_5		0x35
+#define  HYST_SHIFT		4
+#define  CLOSE_DEBOUNCE_SHIFT	2
+#define  FAR_DEBOUNCE_SHIFT	0
+#define PROX_CTRL_6		0x36
+#define PROX_CTRL_7		0x37
+
+#define DIFF_VALUES		65536
+#define CHUNK			4096
+/* per sample error the debounce must bring the decision below */
+#define TARGET_ERROR		1e-6
+
+struct capture {
+	struct sx9324_field_stats stats;
+	uint32_t *hist[SX9324_LIB_PHASES];
+};
+
+static int read_capture(const char *path, struct capture *capture)
+{
+	struct sx9324_sample *samples;
+	long n;
+	long i;
+	int fd;
+	int j;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		n = -errno;
+		fprintf(stderr, "%s: %s\n", path, strerror(-n));
+		return n;
+	}
+
+	samples = malloc(CHUNK * sizeof(*samples));
+	n = samples ? 0 : -ENOMEM;
+	for (j = 0; j < SX9324_LIB_PHASES && !n; j++) {
+		capture->hist[j] = calloc(DIFF_VALUES, sizeof(uint32_t));
+		if (!capture->hist[j])
+			n = -ENOMEM;
+	}
+	if (n) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-n));
+		free(samples);
+		close(fd);
+		return n;
+	}
+
+	while ((n = sx9324_read_samples(fd, samples, CHUNK)) > 0) {
+		sx9324_field_stats(samples, n, SX9324_FIELD_DIFF, &capture->stats);
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < SX9324_LIB_PHASES; j++) {
+				if ((samples[i].valid >> j) & 0x01)
+					capture->hist[j][samples[i].diff[j] + 32768]++;
+			}
+		}
+	}
+	if (n < 0)
+		fprintf(stderr, "%s: %s\n", path, strerror(-n));
+
+	free(samples);
+	close(fd);
+	return n;
+}
+
+static void free_capture(struct capture *capture)
+{
+	int j;
+
+	for (j = 0; j < SX9324_LIB_PHASES; j++)
+		free(capture->hist[j]);
+}
+
+/* samples of the phases at or above each proxdiff value */
+static void cumulate(const struct capture *capture, int first,
+	uint64_t *above)
+{
+	int v, j;
+
+	for (v = DIFF_VALUES - 1; v >= 0; v--) {
+		above[v] = v + 1 < DIFF_VALUES ? above[v + 1] : 0;
+		for (j = first; j < first + 2; j++)
+			above[v] += capture->hist[j][v];
+	}
+}
+
+static uint64_t count_of(const struct capture *capture, int first)
+{
+	return capture->stats.count[first] + capture->stats.count[first + 1];
+}
+
+/* 1, 2, 4 or 8 samples, the first bringing error^samples below target */
+static unsigned int debounce(double error)
+{
+	unsigned int setting;
+
+	for (setting = 0; setting < 3; setting++) {
+		if (pow(error, 1 << setting) < TARGET_ERROR)
+			break;
+	}
+
+	return setting;
+}
+
+/* threshold / 16, / 8 or / 4, the first covering twice the noise */
+static unsigned int hysteresis(int threshold, double noise)
+{
+	unsigned int setting;
+
+	if (!noise)
+		return 0;
+
+	for (setting = 1; setting < 3; setting++) {
+		if ((threshold >> (5 - setting)) >= 2 * noise)
+			break;
+	}
+
+	return setting;
+}
+
+int main(int argc, char *argv[])
+{
+	struct capture near = { 0 }, far = { 0 };
+	uint64_t *near_above = NULL, *far_above = NULL;
+	double noise = 0, sd;
+	double near_error = 0, far_error = 0;
+	double p_near, p_far;
+	unsigned int threshold[2] = { 0, 0 };
+	bool tuned[2] = { false, false };
+	unsigned int hyst = 0;
+	uint64_t errors, best;
+	int reg, first, last;
+	int pair, j;
+	int t;
+	int ret = 1;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <near capture> <far capture>\n",
+			argv[0]);
+		return 1;
+	}
+
+	if (read_capture(argv[1], &near) < 0 || read_capture(argv[2], &far) < 0)
+		goto exit;
+
+	near_above = calloc(DIFF_VALUES, sizeof(*near_above));
+	far_above = calloc(DIFF_VALUES, sizeof(*far_above));
+	if (!near_above || !far_above) {
+		fprintf(stderr, "%s\n", strerror(ENOMEM));
+		goto exit;
+	}
+
+	for (j = 0; j < SX9324_LIB_PHASES; j++) {
+		if (!near.stats.count[j] || !far.stats.count[j])
+			continue;
+		printf("/* phase %d: near mean %.1f sd %.1f, far mean %.1f sd %.1f */\n",
+			j, sx9324_field_mean(&near.stats, j),
+			sqrt(sx9324_field_variance(&near.stats, j)),
+			sx9324_field_mean(&far.stats, j),
+			sqrt(sx9324_field_variance(&far.stats, j)));
+		sd = sqrt(sx9324_field_variance(&near.stats, j));
+		if (sd > noise)
+			noise = sd;
+	}
+
+	/* phases 0/1 share PROX_CTRL_6, phases 2/3 PROX_CTRL_7 */
+	for (pair = 0; pair < 2; pair++) {
+		if (!count_of(&near, 2 * pair) || !count_of(&far, 2 * pair))
+			continue;
+
+		cumulate(&near, 2 * pair, near_above);
+		cumulate(&far, 2 * pair, far_above);
+
+		/* the middle of the run of register values erring least */
+		best = UINT64_MAX;
+		first = last = 0;
+		for (reg = 0; reg < 256; reg++) {
+			t = reg * reg / 2;
+			/* near below the threshold plus far at or above it */
+			errors = count_of(&near, 2 * pair) -
+				near_above[t + 32768] + far_above[t + 32768];
+			if (errors < best) {
+				best = errors;
+				first = last = reg;
+			} else if (errors == best && last == reg - 1) {
+				last = reg;
+			}
+		}
+		threshold[pair] = (first + last) / 2;
+		tuned[pair] = true;
+		t = threshold[pair] * threshold[pair] / 2;
+
+		p_near = 1 - (double)near_above[t + 32768] /
+			count_of(&near, 2 * pair);
+		p_far = (double)far_above[t + 32768] / count_of(&far, 2 * pair);
+		if (p_near > near_error)
+			near_error = p_near;
+		if (p_far > far_error)
+			far_error = p_far;
+
+		if (hysteresis(t, noise) > hyst)
+			hyst = hysteresis(t, noise);
+
+		printf("/* phases %d/%d: threshold %d, %.4f%% near and %.4f%% far samples misdetected */\n",
+			2 * pair, 2 * pair + 1, t, 100 * p_near, 100 * p_far);
+	}
+
+	if (!tuned[0] && !tuned[1]) {
+		fprintf(stderr, "no phase captured both near and far\n");
+		goto exit;
+	}
+
+	/* the threshold of a pair not captured is left alone */
+	printf("semtech,reg-init = /bits/ 8 <0x%02x 0x%02x", PROX_CTRL_5,
+		hyst << HYST_SHIFT |
+		debounce(far_error) << CLOSE_DEBOUNCE_SHIFT |
+		debounce(near_error) << FAR_DEBOUNCE_SHIFT);
+	for (pair = 0; pair < 2; pair++) {
+		if (tuned[pair])
+			printf(" 0x%02x 0x%02x", PROX_CTRL_6 + pair, threshold[pair]);
+	}
+	printf(">;\n");
+	printf("semtech,prox-filter = <1 0 %u>;\n", (unsigned int)ceil(2 * noise));
+	ret = 0;
+
+exit:
+	free(near_above);
+	free(far_above);
+	free_capture(&near);
+	free_capture(&far);
+	return ret;
+}